@@ -0,0 +1,428 @@
+/**
+ * @file sweep the UDP servers on loopback and print one machine-readable
+ * row per configuration
+ *
+ * Every point of the cartesian product of the swept parameters starts a
+ * fresh server in-process, drives it from client threads each keeping
+ * `window` requests in flight with an AsyncClient, and measures for
+ * `seconds` after `warmup` seconds. Rows go to stdout as CSV or JSON, the
+ * servers log to stderr as usual:
+ *
+ *   bench modes=single,sharded sizes=64,512 threads=1,2,4 format=csv > out.csv
+ */
+#include <inttypes.h>
+
+#include <atomic>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/histogram.hpp"
+#include "zeno/net/async-client.hpp"
+#include "zeno/net/multithread-server.hpp"
+#include "zeno/net/options.hpp"
+#include "zeno/net/server.hpp"
+#include "zeno/net/sharded-server.hpp"
+
+using boost::asio::ip::udp;
+using zeno::net::AsyncClient;
+using zeno::net::ReplyStatus;
+
+// replies only count between the warmup and the end of a point
+static std::atomic<bool> measuring{false};
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static std::vector<std::string> Split(const std::string &list)
+{
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+static std::vector<size_t> SplitSizes(const std::string &list)
+{
+    std::vector<size_t> values;
+    for (const auto &item : Split(list))
+    {
+        values.push_back(std::stoul(item));
+    }
+    return values;
+}
+
+/**
+ * @brief one point of the sweep
+ */
+struct Config
+{
+    // single, strand, sharded or uring
+    std::string mode;
+    size_t server_threads;
+    size_t batch;
+    size_t msg_size;
+    size_t threads;
+    size_t window;
+};
+
+struct Result
+{
+    double ops{0};
+    double bytes_per_sec{0};
+    zeno::Histogram latency;
+    uint64_t lost{0};
+    uint64_t shed{0};
+};
+
+/**
+ * @brief the server of a Config, running on its own threads until stop()
+ */
+class ServerRunner
+{
+public:
+    ServerRunner(const Config &config, short port)
+    {
+        zeno::net::ServerOptions options;
+        options.batch_size = config.batch;
+        if (config.mode == "single")
+        {
+            io_context_.reset(new boost::asio::io_context(1));
+            single_.reset(new zeno::net::server(*io_context_, port, options));
+            threads_.emplace_back([this]() { io_context_->run(); });
+        }
+        else if (config.mode == "strand")
+        {
+            io_context_.reset(new boost::asio::io_context());
+            strand_.reset(
+                new zeno::net::MultithreadServer(*io_context_, port, options));
+            for (size_t i = 0; i < config.server_threads; ++i)
+            {
+                threads_.emplace_back([this]() { io_context_->run(); });
+            }
+        }
+        else
+        {
+            check(config.mode == "sharded" || config.mode == "uring",
+                  "unknown mode %s, expect single, strand, sharded or uring",
+                  config.mode.c_str());
+            if (config.mode == "uring")
+            {
+                options.backend = zeno::net::Backend::IoUring;
+            }
+            sharded_.reset(new zeno::net::ShardedServer(
+                port, config.server_threads, options));
+            threads_.emplace_back([this]() { sharded_->run(); });
+        }
+    }
+    ~ServerRunner()
+    {
+        stop();
+    }
+
+    void stop()
+    {
+        if (threads_.empty())
+        {
+            return;
+        }
+        if (io_context_)
+        {
+            io_context_->stop();
+        }
+        if (sharded_)
+        {
+            sharded_->stop();
+        }
+        for (auto &t : threads_)
+        {
+            t.join();
+        }
+        threads_.clear();
+    }
+
+private:
+    std::unique_ptr<boost::asio::io_context> io_context_;
+    std::unique_ptr<zeno::net::server> single_;
+    std::unique_ptr<zeno::net::MultithreadServer> strand_;
+    std::unique_ptr<zeno::net::ShardedServer> sharded_;
+    std::vector<std::thread> threads_;
+};
+
+/**
+ * @brief the closed loop of one client thread: every completion issues the
+ * next request
+ */
+struct Recorder
+{
+    void operator()(uint64_t start, ReplyStatus status, const char *, size_t)
+    {
+        if (measuring.load(std::memory_order_relaxed))
+        {
+            if (status == ReplyStatus::Ok)
+            {
+                latency.record(now_ns() - start);
+                ops++;
+            }
+            else if (status == ReplyStatus::Overloaded)
+            {
+                shed++;
+            }
+            else
+            {
+                lost++;
+            }
+        }
+        client->send(body.data(), body.size(), now_ns());
+    }
+
+    AsyncClient<Recorder> *client{nullptr};
+    std::vector<char> body;
+    zeno::Histogram latency;
+    uint64_t ops{0};
+    uint64_t lost{0};
+    uint64_t shed{0};
+};
+
+struct Worker
+{
+    boost::asio::io_context io_context{1};
+    std::unique_ptr<AsyncClient<Recorder>> client;
+};
+
+static Result RunPoint(const Config &config,
+                       short port,
+                       double warmup,
+                       double seconds)
+{
+    check(config.msg_size >= AsyncClient<Recorder>::kRequestOverhead &&
+              config.msg_size <= AsyncClient<Recorder>::kMaxPacket,
+          "message size %lu out of [%lu, %lu]",
+          config.msg_size,
+          AsyncClient<Recorder>::kRequestOverhead,
+          AsyncClient<Recorder>::kMaxPacket);
+    ServerRunner server(config, port);
+
+    udp::endpoint endpoint(boost::asio::ip::address_v4::loopback(), port);
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < config.threads; ++i)
+    {
+        workers.emplace_back(new Worker());
+        Worker &worker = *workers.back();
+        zeno::net::AsyncClientOptions options;
+        options.max_inflight = config.window;
+        worker.client.reset(new AsyncClient<Recorder>(
+            worker.io_context, endpoint, i, options));
+        Recorder &recorder = worker.client->on_reply();
+        recorder.client = worker.client.get();
+        recorder.body.assign(
+            config.msg_size - AsyncClient<Recorder>::kRequestOverhead, i);
+    }
+    for (auto &w : workers)
+    {
+        Worker *worker = w.get();
+        threads.emplace_back([worker, &config]() {
+            Recorder &recorder = worker->client->on_reply();
+            for (size_t i = 0; i < config.window; ++i)
+            {
+                worker->client->send(
+                    recorder.body.data(), recorder.body.size(), now_ns());
+            }
+            worker->io_context.run();
+        });
+    }
+
+    std::this_thread::sleep_for(std::chrono::duration<double>(warmup));
+    auto start = std::chrono::steady_clock::now();
+    measuring = true;
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    measuring = false;
+    double elapsed = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+
+    for (auto &w : workers)
+    {
+        w->io_context.stop();
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    server.stop();
+
+    Result result;
+    uint64_t ops = 0;
+    for (auto &w : workers)
+    {
+        Recorder &recorder = w->client->on_reply();
+        result.latency.merge(recorder.latency);
+        ops += recorder.ops;
+        result.lost += recorder.lost;
+        result.shed += recorder.shed;
+    }
+    result.ops = ops / elapsed;
+    result.bytes_per_sec = result.ops * config.msg_size;
+    return result;
+}
+
+static const char *kColumns[] = {
+    "mode",    "server_threads", "batch",  "msg_size", "threads",
+    "window",  "ops",            "MBps",   "p50_ns",   "p99_ns",
+    "p999_ns", "max_ns",         "lost",   "shed"};
+
+static void PrintRow(const std::string &format,
+                     size_t row,
+                     const Config &c,
+                     const Result &r)
+{
+    std::ostringstream values[14];
+    values[0] << c.mode;
+    values[1] << c.server_threads;
+    values[2] << c.batch;
+    values[3] << c.msg_size;
+    values[4] << c.threads;
+    values[5] << c.window;
+    values[6] << (uint64_t) r.ops;
+    values[7] << r.bytes_per_sec / 1e6;
+    values[8] << r.latency.percentile(50);
+    values[9] << r.latency.percentile(99);
+    values[10] << r.latency.percentile(99.9);
+    values[11] << r.latency.max();
+    values[12] << r.lost;
+    values[13] << r.shed;
+
+    if (format == "json")
+    {
+        std::cout << (row == 0 ? "[\n" : ",\n") << "  {";
+        for (size_t i = 0; i < 14; ++i)
+        {
+            std::cout << (i ? ", " : "") << '"' << kColumns[i] << "\": ";
+            if (i == 0)
+            {
+                std::cout << '"' << values[i].str() << '"';
+            }
+            else
+            {
+                std::cout << values[i].str();
+            }
+        }
+        std::cout << "}" << std::flush;
+        return;
+    }
+    if (row == 0)
+    {
+        for (size_t i = 0; i < 14; ++i)
+        {
+            std::cout << (i ? "," : "") << kColumns[i];
+        }
+        std::cout << "\n";
+    }
+    for (size_t i = 0; i < 14; ++i)
+    {
+        std::cout << (i ? "," : "") << values[i].str();
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::map<std::string, std::string> args = {
+        {"modes", "single,sharded"},
+        {"server_threads", "1"},
+        {"batches", "1,32"},
+        {"sizes", "64,256,1024"},
+        {"threads", "1,2"},
+        {"windows", "1,32"},
+        {"seconds", "2"},
+        {"warmup", "1"},
+        {"format", "csv"},
+        {"port", "9600"},
+    };
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        auto eq = arg.find('=');
+        if (eq == std::string::npos || !args.count(arg.substr(0, eq)))
+        {
+            std::cerr << "Usage: bench [key=value ...], with the defaults\n";
+            for (const auto &kv : args)
+            {
+                std::cerr << "  " << kv.first << "=" << kv.second << "\n";
+            }
+            std::cerr << "modes: single, strand, sharded, uring. "
+                         "format: csv, json.\n";
+            return 1;
+        }
+        args[arg.substr(0, eq)] = arg.substr(eq + 1);
+    }
+    const std::string &format = args["format"];
+    check(format == "csv" || format == "json",
+          "unknown format %s, expect csv or json",
+          format.c_str());
+    double seconds = std::stod(args["seconds"]);
+    double warmup = std::stod(args["warmup"]);
+    int port = std::stoi(args["port"]);
+
+    size_t row = 0;
+    for (const auto &mode : Split(args["modes"]))
+    {
+        for (size_t server_threads : SplitSizes(args["server_threads"]))
+        {
+            // the single server has one thread whatever asked
+            if (mode == "single" && server_threads != 1)
+            {
+                continue;
+            }
+            for (size_t batch : SplitSizes(args["batches"]))
+            {
+                for (size_t msg_size : SplitSizes(args["sizes"]))
+                {
+                    for (size_t threads : SplitSizes(args["threads"]))
+                    {
+                        for (size_t window : SplitSizes(args["windows"]))
+                        {
+                            Config config{mode,
+                                          server_threads,
+                                          batch,
+                                          msg_size,
+                                          threads,
+                                          window};
+                            // a fresh port per point, so that no late reply
+                            // of the previous one leaks in.
+                            short point_port = port + row % 1000;
+                            Result result =
+                                RunPoint(config, point_port, warmup, seconds);
+                            PrintRow(format, row++, config, result);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    if (format == "json")
+    {
+        std::cout << (row ? "\n]\n" : "[]\n");
+    }
+    return 0;
+}
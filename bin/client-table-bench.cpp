@@ -0,0 +1,178 @@
+#include <inttypes.h>
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/address.hpp"
+#include "zeno/net/client-table.hpp"
+#include "zeno/smart.hpp"
+
+using zeno::net::ClientAddress;
+using zeno::net::ClientId;
+
+constexpr static uint64_t kLookupPerThread = 10 * zeno::define::M;
+
+static uint64_t xorshift(uint64_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+template <typename F>
+static double measure(const char *name, uint64_t ops, F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    double ops_per_sec = 1.0 * ops * 1000 * 1000 * 1000 / ns;
+    info("%-48s %s (%s per op)",
+         name,
+         zeno::smart::toOps(ops_per_sec).c_str(),
+         zeno::smart::nsToLatency(1.0 * ns / ops).c_str());
+    return ops_per_sec;
+}
+
+template <typename F>
+static void run_threads(size_t thread_nr, F &&f)
+{
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < thread_nr; ++i)
+    {
+        threads.emplace_back(f, i);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        std::cerr << "Usage: client-table-bench <clients> <thread>\n";
+        return 1;
+    }
+    uint64_t client_nr = std::stoull(argv[1]);
+    size_t thread_nr = std::stoul(argv[2]);
+
+    ClientAddress address;
+    memset(&address, 0, sizeof(address));
+    address.v4.sin_family = AF_INET;
+    address.len = sizeof(address.v4);
+
+    std::unordered_map<ClientId, ClientAddress> map;
+    zeno::net::ClientTable<ClientAddress> table;
+
+    measure("std::unordered_map insert", client_nr, [&]() {
+        for (ClientId id = 0; id < client_nr; ++id)
+        {
+            address.v4.sin_port = id;
+            map[id] = address;
+        }
+    });
+    measure("ClientTable insert", client_nr, [&]() {
+        for (ClientId id = 0; id < client_nr; ++id)
+        {
+            address.v4.sin_port = id;
+            table.upsert(id, address);
+        }
+    });
+    check(table.size() == client_nr, "table holds %lu", table.size());
+
+    std::atomic<uint64_t> found{0};
+    measure("std::unordered_map lookup, 1 thread", kLookupPerThread, [&]() {
+        uint64_t state = 88172645463325252ull;
+        uint64_t hit = 0;
+        for (uint64_t i = 0; i < kLookupPerThread; ++i)
+        {
+            auto it = map.find(xorshift(state) % client_nr);
+            hit += it->second.v4.sin_port;
+        }
+        found += hit;
+    });
+    measure("ClientTable lookup, 1 thread", kLookupPerThread, [&]() {
+        uint64_t state = 88172645463325252ull;
+        uint64_t hit = 0;
+        ClientAddress out;
+        for (uint64_t i = 0; i < kLookupPerThread; ++i)
+        {
+            table.find(xorshift(state) % client_nr, &out);
+            hit += out.v4.sin_port;
+        }
+        found += hit;
+    });
+
+    std::mutex map_mutex;
+    std::string name = "std::unordered_map + mutex lookup, " +
+                       std::to_string(thread_nr) + " threads";
+    measure(name.c_str(), kLookupPerThread * thread_nr, [&]() {
+        run_threads(thread_nr, [&](size_t tid) {
+            uint64_t state = 88172645463325252ull + tid;
+            uint64_t hit = 0;
+            for (uint64_t i = 0; i < kLookupPerThread; ++i)
+            {
+                std::lock_guard<std::mutex> lk(map_mutex);
+                hit += map.find(xorshift(state) % client_nr)->second.v4.sin_port;
+            }
+            found += hit;
+        });
+    });
+    name = "ClientTable lookup, " + std::to_string(thread_nr) + " threads";
+    measure(name.c_str(), kLookupPerThread * thread_nr, [&]() {
+        run_threads(thread_nr, [&](size_t tid) {
+            uint64_t state = 88172645463325252ull + tid;
+            uint64_t hit = 0;
+            ClientAddress out;
+            for (uint64_t i = 0; i < kLookupPerThread; ++i)
+            {
+                table.find(xorshift(state) % client_nr, &out);
+                hit += out.v4.sin_port;
+            }
+            found += hit;
+        });
+    });
+
+    // readers keep going while one thread churns the table.
+    std::atomic<bool> stop{false};
+    std::thread writer([&]() {
+        uint64_t state = 1;
+        while (!stop.load(std::memory_order_relaxed))
+        {
+            ClientId id = client_nr + xorshift(state) % client_nr;
+            table.upsert(id, address);
+            table.erase(id);
+        }
+    });
+    name = "ClientTable lookup + 1 writer, " + std::to_string(thread_nr) +
+           " threads";
+    measure(name.c_str(), kLookupPerThread * thread_nr, [&]() {
+        run_threads(thread_nr, [&](size_t tid) {
+            uint64_t state = 88172645463325252ull + tid;
+            uint64_t hit = 0;
+            ClientAddress out;
+            for (uint64_t i = 0; i < kLookupPerThread; ++i)
+            {
+                table.find(xorshift(state) % client_nr, &out);
+                hit += out.v4.sin_port;
+            }
+            found += hit;
+        });
+    });
+    stop = true;
+    writer.join();
+
+    dinfo("checksum %" PRIu64, found.load());
+    return 0;
+}
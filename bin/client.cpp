@@ -15,29 +15,61 @@
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
+#include <thread>
 #include <zeno/smart.hpp>
 
 #include "zeno/debug.hpp"
+#include "zeno/histogram.hpp"
+#include "zeno/net/async-client.hpp"
+#include "zeno/net/coalescer.hpp"
 #include "zeno/net/header.hpp"
+#include "zeno/net/mmsg.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/net/ring-buffer.hpp"
+#include "zeno/net/shm-client.hpp"
+#include "zeno/placement.hpp"
 
+using boost::asio::ip::tcp;
 using boost::asio::ip::udp;
 
 constexpr static int kMaxLength = 1024;
 constexpr static int kMsgLength = 64;
 constexpr static int kClientSendBatch = 100;
+// an open-loop request without reply after this long is counted as lost.
+constexpr static uint64_t kLostTimeoutNs = 1000ull * 1000 * 1000;
 
 std::atomic<uint64_t> count{0};
+std::atomic<uint64_t> lost{0};
+// requests the server answered with an Overload
+std::atomic<uint64_t> shed{0};
+// payload bytes sent, for the modes measuring bandwidth
+std::atomic<uint64_t> bytes{0};
+std::vector<std::unique_ptr<zeno::ConcurrentHistogram>> latencies;
 
-void client_loop(int id, const char *host, const char *port)
+static uint64_t now_ns()
 {
-    char buffer[kMaxLength];
-    char dev_null[kMaxLength];
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
 
+static void init_request(char *buffer, int id)
+{
     auto &packet_header = *(zeno::net::PacketHeader *) buffer;
 
     packet_header.packet_length = kMsgLength;
+    packet_header.checksum = 0;
     packet_header.client_id = id;
     packet_header.packet_type = zeno::net::PacketType::Normal;
+}
+
+void client_loop(int id, const char *host, const char *port)
+{
+    char buffer[kMaxLength];
+    char dev_null[kMaxLength];
+
+    init_request(buffer, id);
 
     boost::asio::io_context io_context;
 
@@ -50,36 +82,538 @@ void client_loop(int id, const char *host, const char *port)
     info("Client %d connects to %s:%s", id, host, port);
 
     udp::endpoint sender_endpoint;
+    auto &latency = *latencies[id];
 
     while (true)
     {
         for (int i = 0; i < kClientSendBatch; ++i)
         {
+            uint64_t start = now_ns();
             s.send_to(boost::asio::buffer(buffer, kMsgLength),
                       *endpoints.begin());
 
             s.receive_from(boost::asio::buffer(dev_null, kMaxLength),
                            sender_endpoint);
+            latency.record(now_ns() - start);
         }
         count.fetch_add(kClientSendBatch, std::memory_order_relaxed);
     }
 }
 
+/**
+ * @brief closed loop, but every datagram is a Frame of @p per_frame messages
+ *
+ * Messages go through a Coalescer, and the reply is parsed back into its
+ * messages. Ops count logical messages, not datagrams.
+ */
+void frame_loop(int id, const char *host, const char *port, size_t per_frame)
+{
+    char payload[kMsgLength];
+    char dev_null[kMaxLength];
+    memset(payload, id, sizeof(payload));
+
+    boost::asio::io_context io_context;
+
+    udp::socket s(io_context, udp::endpoint(udp::v4(), 0));
+
+    udp::resolver resolver(io_context);
+    udp::endpoint server = *resolver.resolve(udp::v4(), host, port).begin();
+
+    zeno::net::Coalescer coalescer(
+        id,
+        kMaxLength,
+        std::chrono::microseconds(50),
+        [&](const char *data, size_t length) {
+            s.send_to(boost::asio::buffer(data, length), server);
+        });
+    check(per_frame * (sizeof(zeno::net::MessageLength) + kMsgLength) +
+                  zeno::net::kFrameOverhead <=
+              kMaxLength,
+          "%lu messages of %d bytes do not fit in one datagram",
+          per_frame,
+          kMsgLength);
+
+    info("Client %d connects to %s:%s, %lu messages per datagram",
+         id,
+         host,
+         port,
+         per_frame);
+
+    udp::endpoint sender_endpoint;
+    auto &latency = *latencies[id];
+
+    while (true)
+    {
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < per_frame; ++i)
+        {
+            coalescer.append(payload, kMsgLength);
+        }
+        coalescer.flush();
+
+        size_t len = s.receive_from(boost::asio::buffer(dev_null, kMaxLength),
+                                    sender_endpoint);
+        latency.record(now_ns() - start);
+
+        uint64_t nr = 0;
+        for (const auto &msg : zeno::net::ParseFrame(dev_null, len))
+        {
+            dcheck(msg.length == kMsgLength);
+            (void) msg;
+            nr++;
+        }
+        count.fetch_add(nr, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief closed loop over TCP, with @p depth requests pipelined per round
+ *
+ * The requests of a round go out with one write. The replies are read into
+ * a RingBuffer and split back into packets with the same framing as the
+ * server.
+ */
+void tcp_loop(int id, const char *host, const char *port, size_t depth)
+{
+    std::vector<char> requests(depth * kMsgLength);
+    for (size_t i = 0; i < depth; ++i)
+    {
+        init_request(requests.data() + i * kMsgLength, id);
+    }
+    zeno::net::RingBuffer ring(std::max<size_t>(requests.size(), kMaxLength));
+
+    boost::asio::io_context io_context;
+    tcp::socket s(io_context);
+    tcp::resolver resolver(io_context);
+    boost::asio::connect(s, resolver.resolve(tcp::v4(), host, port));
+    s.set_option(tcp::no_delay(true));
+
+    info("Client %d connects to %s:%s over tcp, %lu requests in flight",
+         id,
+         host,
+         port,
+         depth);
+
+    auto &latency = *latencies[id];
+
+    while (true)
+    {
+        uint64_t start = now_ns();
+        boost::asio::write(s, boost::asio::buffer(requests));
+
+        size_t replies = 0;
+        while (replies < depth)
+        {
+            ring.commit(s.read_some(
+                boost::asio::buffer(ring.write_ptr(), ring.writable())));
+            ssize_t n = zeno::net::ParseStream(
+                ring.read_ptr(),
+                ring.readable(),
+                ring.capacity(),
+                [&](char *, size_t) { replies++; });
+            check(n >= 0, "malformed reply from the server");
+            ring.consume(n);
+        }
+        uint64_t rtt = now_ns() - start;
+        for (size_t i = 0; i < depth; ++i)
+        {
+            latency.record(rtt);
+        }
+        count.fetch_add(depth, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief closed loop through the shared memory of a ShmServer on the same
+ * host, with @p depth requests per round. @p host is ignored.
+ */
+void shm_loop(int id, const char *port, size_t depth)
+{
+    char request[kMsgLength];
+    init_request(request, id);
+
+    zeno::net::ShmClient client(std::atoi(port), id);
+    info("Client %d attaches to shm server %s, %lu requests in flight",
+         id,
+         port,
+         depth);
+
+    auto &latency = *latencies[id];
+
+    while (true)
+    {
+        uint64_t start = now_ns();
+        for (size_t i = 0; i < depth; ++i)
+        {
+            client.send(request, kMsgLength);
+        }
+        client.flush();
+
+        size_t replies = 0;
+        while (replies < depth)
+        {
+            replies += client.receive([](const char *, size_t) {});
+        }
+        uint64_t rtt = now_ns() - start;
+        for (size_t i = 0; i < depth; ++i)
+        {
+            latency.record(rtt);
+        }
+        count.fetch_add(depth, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief closed loop of bulk transfers: each round sends @p segments
+ * messages of @p msg_size bytes and waits for all the replies
+ *
+ * With @p gso the round goes out as one sendmsg with UDP_SEGMENT, and
+ * replies are received with UDP_GRO and split back into their messages.
+ * Without, it is one send_to per message, for comparison.
+ */
+void gso_loop(int id,
+              const char *host,
+              const char *port,
+              size_t msg_size,
+              size_t segments,
+              bool gso)
+{
+    check(msg_size >= sizeof(zeno::net::PacketHeader),
+          "message size should hold a header");
+    check(msg_size * segments <= zeno::net::MsgBatch::kMaxSuperPacket,
+          "%lu messages of %lu bytes exceed one super-packet",
+          segments,
+          msg_size);
+    std::vector<char> round(msg_size * segments);
+    for (size_t i = 0; i < segments; ++i)
+    {
+        char *msg = round.data() + i * msg_size;
+        init_request(msg, id);
+        ((zeno::net::PacketHeader *) msg)->packet_length = msg_size;
+    }
+
+    boost::asio::io_context io_context;
+    udp::socket s(io_context, udp::endpoint(udp::v4(), 0));
+    udp::resolver resolver(io_context);
+    udp::endpoint server = *resolver.resolve(udp::v4(), host, port).begin();
+    int fd = s.native_handle();
+
+    // one slot, used to send a whole round with UDP_SEGMENT and to receive
+    // the GRO super-packets of the reply.
+    zeno::net::MsgBatch batch(1, zeno::net::MsgBatch::kMaxSuperPacket, true);
+    if (gso)
+    {
+        zeno::net::EnableGro(fd);
+    }
+
+    info("Client %d sends %lu x %lu bytes per round to %s:%s%s",
+         id,
+         segments,
+         msg_size,
+         host,
+         port,
+         gso ? " with GSO/GRO" : "");
+
+    auto &latency = *latencies[id];
+
+    while (true)
+    {
+        uint64_t start = now_ns();
+        if (gso)
+        {
+            memcpy(batch.data(0), round.data(), round.size());
+            batch.set_name(0, server.data(), server.size());
+            batch.set_length(0, round.size());
+            batch.set_segment_size(0, msg_size);
+            check(batch.send(fd, 0, 1, 0) == 1,
+                  "sendmsg failed: %s",
+                  strerror(errno));
+        }
+        else
+        {
+            for (size_t i = 0; i < segments; ++i)
+            {
+                s.send_to(
+                    boost::asio::buffer(round.data() + i * msg_size, msg_size),
+                    server);
+            }
+        }
+
+        size_t replies = 0;
+        while (replies < segments)
+        {
+            int nr = batch.recv(fd, 0);
+            check(nr == 1, "recvmsg failed: %s", strerror(errno));
+            replies += zeno::net::ForEachSegment(batch.data(0),
+                                                 batch.length(0),
+                                                 batch.segment_size(0),
+                                                 [](const char *, size_t) {});
+        }
+        latency.record(now_ns() - start);
+        count.fetch_add(segments, std::memory_order_relaxed);
+        bytes.fetch_add(round.size(), std::memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief keep @p concurrency requests in flight from this single thread
+ * with an AsyncClient, issuing a new request as soon as one completes
+ */
+struct Reissue
+{
+    void operator()(uint64_t start, zeno::net::ReplyStatus status,
+                    const char *, size_t)
+    {
+        if (status == zeno::net::ReplyStatus::Ok)
+        {
+            latency->record(now_ns() - start);
+            count.fetch_add(1, std::memory_order_relaxed);
+        }
+        else if (status == zeno::net::ReplyStatus::Overloaded)
+        {
+            shed.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            lost.fetch_add(1, std::memory_order_relaxed);
+        }
+        client->send(body, sizeof(body), now_ns());
+    }
+
+    zeno::net::AsyncClient<Reissue> *client;
+    zeno::ConcurrentHistogram *latency;
+    // the request id goes after the header
+    char body[kMsgLength - sizeof(zeno::net::PacketHeader) - sizeof(uint64_t)];
+};
+
+void async_loop(int id, const char *host, const char *port, size_t concurrency)
+{
+    boost::asio::io_context io_context(1);
+    udp::resolver resolver(io_context);
+    udp::endpoint server = *resolver.resolve(udp::v4(), host, port).begin();
+
+    zeno::net::AsyncClientOptions options;
+    options.max_inflight = concurrency;
+    options.checksum = zeno::net::ChecksumFromEnv();
+    zeno::net::AsyncClient<Reissue> client(io_context, server, id, options);
+    Reissue &reissue = client.on_reply();
+    reissue.client = &client;
+    reissue.latency = latencies[id].get();
+    memset(reissue.body, id, sizeof(reissue.body));
+
+    info("Client %d connects to %s:%s, %lu requests in flight from one thread",
+         id,
+         host,
+         port,
+         concurrency);
+
+    for (size_t i = 0; i < concurrency; ++i)
+    {
+        client.send(reissue.body, sizeof(reissue.body), now_ns());
+    }
+    io_context.run();
+}
+
+/**
+ * @brief send at a fixed rate regardless of the replies
+ *
+ * Every request carries a sequence number in its body, echoed back by the
+ * server. At most @p outstanding requests are in flight. Latency is
+ * measured from the time a request was *scheduled*, not actually sent, so
+ * that a stalled sender does not hide queueing (coordinated omission).
+ */
+void open_loop(int id,
+               const char *host,
+               const char *port,
+               double rate,
+               size_t outstanding)
+{
+    char buffer[kMaxLength];
+    char dev_null[kMaxLength];
+
+    init_request(buffer, id);
+    auto *request_seq = (uint64_t *) zeno::net::ParsePacketBody(buffer);
+
+    boost::asio::io_context io_context;
+
+    udp::socket s(io_context, udp::endpoint(udp::v4(), 0));
+    s.non_blocking(true);
+
+    udp::resolver resolver(io_context);
+    udp::endpoint server = *resolver.resolve(udp::v4(), host, port).begin();
+
+    info("Client %d sends %s to %s:%s with %lu outstanding",
+         id,
+         zeno::smart::toOps(rate).c_str(),
+         host,
+         port,
+         outstanding);
+
+    struct Slot
+    {
+        uint64_t seq;
+        uint64_t scheduled_ns;
+        bool busy;
+    };
+    size_t window = 1;
+    while (window < outstanding)
+    {
+        window *= 2;
+    }
+    std::vector<Slot> slots(window, Slot{0, 0, false});
+    const size_t mask = window - 1;
+
+    udp::endpoint sender_endpoint;
+    auto &latency = *latencies[id];
+    boost::system::error_code ec;
+
+    const uint64_t interval_ns = 1e9 / rate;
+    uint64_t next_send = now_ns();
+    uint64_t seq = 0;
+    uint64_t oldest = 0;
+    size_t inflight = 0;
+
+    while (true)
+    {
+        uint64_t now = now_ns();
+
+        // forget the requests whose reply never came, oldest first.
+        while (oldest < seq)
+        {
+            Slot &slot = slots[oldest & mask];
+            if (slot.busy && slot.seq == oldest)
+            {
+                if (now - slot.scheduled_ns < kLostTimeoutNs)
+                {
+                    break;
+                }
+                slot.busy = false;
+                inflight--;
+                lost.fetch_add(1, std::memory_order_relaxed);
+            }
+            oldest++;
+        }
+
+        while (now >= next_send && inflight < outstanding &&
+               seq - oldest < window)
+        {
+            *request_seq = seq;
+            s.send_to(
+                boost::asio::buffer(buffer, kMsgLength), server, 0, ec);
+            if (ec)
+            {
+                break;
+            }
+            slots[seq & mask] = Slot{seq, next_send, true};
+            inflight++;
+            seq++;
+            next_send += interval_ns;
+        }
+
+        uint64_t done = 0;
+        uint64_t dropped = 0;
+        while (true)
+        {
+            size_t len = s.receive_from(boost::asio::buffer(dev_null, kMaxLength),
+                                        sender_endpoint,
+                                        0,
+                                        ec);
+            if (ec)
+            {
+                break;
+            }
+            if (len < sizeof(zeno::net::PacketHeader) + sizeof(uint64_t))
+            {
+                continue;
+            }
+            uint64_t reply_seq =
+                *(uint64_t *) zeno::net::ParsePacketBody(dev_null);
+            Slot &slot = slots[reply_seq & mask];
+            if (slot.busy && slot.seq == reply_seq)
+            {
+                slot.busy = false;
+                inflight--;
+                // an Overload echoes the sequence number, but nothing was
+                // served.
+                if (zeno::net::ParsePacketType(dev_null) ==
+                    zeno::net::PacketType::Overload)
+                {
+                    dropped++;
+                    continue;
+                }
+                latency.record(now_ns() - slot.scheduled_ns);
+                done++;
+            }
+        }
+        if (done)
+        {
+            count.fetch_add(done, std::memory_order_relaxed);
+        }
+        if (dropped)
+        {
+            shed.fetch_add(dropped, std::memory_order_relaxed);
+        }
+    }
+}
+
 int main(int argc, char *argv[])
 {
     check(kMsgLength < kMaxLength, "msg size should < max length");
+    check(kMsgLength >= sizeof(zeno::net::PacketHeader) + sizeof(uint64_t),
+          "msg size should hold the header and a sequence number");
 
     std::vector<std::thread> client_threads;
 
+    if (argc < 4 || argc > 8)
+    {
+        std::cerr << "Usage: blocking_udp_echo_client <host> <port> <thread> "
+                     "[closed | open <rate> <outstanding> | frame <msg_nr> | "
+                     "tcp <depth> | shm <depth> | async <concurrency> | "
+                     "udp <msg_size> <segments> [gso]]\n"
+                     "ZENO_PLACEMENT=none|compact|spread|<cpu list> pins the "
+                     "client threads.\n"
+                     "ZENO_CHECKSUM=1 seals the async requests with a "
+                     "CRC32C.\n";
+        return 1;
+    }
+    auto placement = zeno::Placement::FromEnv();
+    const char *host = argv[1];
+    const char *port = argv[2];
+    int thread_nr = std::stoi(argv[3]);
+    std::string mode = argc >= 5 ? argv[4] : "closed";
+    check(mode == "closed" || (mode == "open" && argc == 7) ||
+              (mode == "frame" && argc == 6) || (mode == "tcp" && argc == 6) ||
+              (mode == "shm" && argc == 6) || (mode == "async" && argc == 6) ||
+              (mode == "udp" && (argc == 7 || argc == 8)),
+          "unknown mode %s",
+          mode.c_str());
+
+    for (int i = 0; i < thread_nr; ++i)
+    {
+        latencies.emplace_back(new zeno::ConcurrentHistogram());
+    }
+
     std::thread timer([&]() {
         uint64_t last_value = 0;
+        uint64_t last_lost = 0;
+        uint64_t last_bytes = 0;
+        uint64_t last_shed = 0;
         auto last_time = std::chrono::steady_clock::now();
+        zeno::Histogram latency;
         while (true)
         {
             sleep(1);
 
             uint64_t value = count.load(std::memory_order_relaxed);
+            uint64_t lost_value = lost.load(std::memory_order_relaxed);
+            uint64_t bytes_value = bytes.load(std::memory_order_relaxed);
+            uint64_t shed_value = shed.load(std::memory_order_relaxed);
             auto now = std::chrono::steady_clock::now();
+            latency.reset();
+            for (auto &l : latencies)
+            {
+                l->drain_into(latency);
+            }
 
             uint64_t diff_value = value - last_value;
             auto diff_us =
@@ -90,28 +624,76 @@ int main(int argc, char *argv[])
             double ops = diff_value * 1000 * 1000 / diff_us;
 
             info("Client Ops: %s (diff_value: %" PRIu64 " in diff_us: %" PRIu64
-                 " )",
+                 " ), lost %" PRIu64,
                  zeno::smart::toOps(ops).c_str(),
                  diff_value,
-                 diff_us);
+                 diff_us,
+                 lost_value - last_lost);
+            info("Latency p50: %s, p99: %s, p99.9: %s, max: %s",
+                 zeno::smart::nsToLatency(latency.percentile(50)).c_str(),
+                 zeno::smart::nsToLatency(latency.percentile(99)).c_str(),
+                 zeno::smart::nsToLatency(latency.percentile(99.9)).c_str(),
+                 zeno::smart::nsToLatency(latency.max()).c_str());
+            info_if(bytes_value != last_bytes,
+                    "Bandwidth: %s/s",
+                    zeno::smart::toSize(1e6 * (bytes_value - last_bytes) /
+                                        diff_us)
+                        .c_str());
+            info_if(shed_value != last_shed,
+                    "Shed by the server: %" PRIu64,
+                    shed_value - last_shed);
 
             last_value = value;
+            last_lost = lost_value;
+            last_bytes = bytes_value;
+            last_shed = shed_value;
             last_time = now;
         }
     });
 
-    if (argc != 4)
-    {
-        std::cerr << "Usage: blocking_udp_echo_client <host> <port> <thread>\n";
-        return 1;
-    }
-    const char *host = argv[1];
-    const char *port = argv[2];
-    int thread_nr = std::stoi(argv[3]);
-
     for (int i = 0; i < thread_nr; ++i)
     {
-        client_threads.emplace_back(client_loop, i, host, port);
+        client_threads.emplace_back([&, i]() {
+            // pinned first, so that the buffers of the loop are node-local.
+            placement.pin(i);
+            if (mode == "open")
+            {
+                open_loop(i,
+                          host,
+                          port,
+                          std::stod(argv[5]) / thread_nr,
+                          (size_t) std::stoul(argv[6]));
+            }
+            else if (mode == "frame")
+            {
+                frame_loop(i, host, port, (size_t) std::stoul(argv[5]));
+            }
+            else if (mode == "tcp")
+            {
+                tcp_loop(i, host, port, (size_t) std::stoul(argv[5]));
+            }
+            else if (mode == "shm")
+            {
+                shm_loop(i, port, (size_t) std::stoul(argv[5]));
+            }
+            else if (mode == "async")
+            {
+                async_loop(i, host, port, (size_t) std::stoul(argv[5]));
+            }
+            else if (mode == "udp")
+            {
+                gso_loop(i,
+                         host,
+                         port,
+                         (size_t) std::stoul(argv[5]),
+                         (size_t) std::stoul(argv[6]),
+                         argc == 8 && std::string(argv[7]) == "gso");
+            }
+            else
+            {
+                client_loop(i, host, port);
+            }
+        });
     }
 
     try
@@ -128,4 +710,4 @@ int main(int argc, char *argv[])
     }
 
     return 0;
-}
\ No newline at end of file
+}
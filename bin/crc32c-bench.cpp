@@ -0,0 +1,152 @@
+#include <inttypes.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "zeno/crc32c.hpp"
+#include "zeno/debug.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/smart.hpp"
+
+constexpr static uint64_t kBytesPerRun = 1ull << 30;
+
+static uint64_t xorshift(uint64_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+/**
+ * @brief run @p f, which processes @p bytes, and log the throughput on one
+ * core
+ */
+template <typename F>
+static void measure(const std::string &name, uint64_t bytes, F &&f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::steady_clock::now() - start)
+                  .count();
+    info("%-40s %s/s",
+         name.c_str(),
+         zeno::smart::toSize(1e9 * bytes / ns).c_str());
+}
+
+static void verify(const std::vector<char> &data)
+{
+    check(zeno::Crc32c("123456789", 9) == 0xe3069283,
+          "wrong CRC32C of the check string");
+    for (size_t length = 0; length < 16 * 1024; length = length * 3 / 2 + 1)
+    {
+        for (size_t offset = 0; offset < 8; ++offset)
+        {
+            uint32_t hardware = zeno::Crc32c(data.data() + offset, length);
+            check(hardware == zeno::Crc32cPortable(data.data() + offset, length),
+                  "CRC32C paths disagree on %lu bytes at offset %lu",
+                  length,
+                  offset);
+            size_t half = length / 2;
+            check(zeno::Crc32c(data.data() + offset + half,
+                               length - half,
+                               zeno::Crc32c(data.data() + offset, half)) ==
+                      hardware,
+                  "CRC32C does not compose on %lu bytes",
+                  length);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2)
+    {
+        std::cerr << "Usage: crc32c-bench [packet_size]\n";
+        return 1;
+    }
+    size_t packet_size = argc == 2 ? std::stoul(argv[1]) : 64;
+    check(packet_size >= sizeof(zeno::net::PacketHeader),
+          "packets should hold a header");
+
+    std::vector<char> data(64 * 1024 + 8);
+    uint64_t state = 88172645463325252ull;
+    for (auto &c : data)
+    {
+        c = xorshift(state);
+    }
+    verify(data);
+    info("CRC32C %s", zeno::Crc32cAccelerated() ? "with SSE4.2 and PCLMUL"
+                                                : "in software only");
+
+    uint32_t sink = 0;
+    for (size_t length : {64ul, 256ul, 1024ul, 4096ul, 65536ul})
+    {
+        uint64_t runs = kBytesPerRun / length;
+        // the table is several times slower: a quarter of the bytes will do.
+        measure("Crc32cPortable, " + std::to_string(length) + " B",
+                runs / 4 * length,
+                [&]() {
+                    for (uint64_t i = 0; i < runs / 4; ++i)
+                    {
+                        sink += zeno::Crc32cPortable(data.data(), length, sink);
+                    }
+                });
+        measure("Crc32c, " + std::to_string(length) + " B",
+                runs * length,
+                [&]() {
+                    for (uint64_t i = 0; i < runs; ++i)
+                    {
+                        sink += zeno::Crc32c(data.data(), length, sink);
+                    }
+                });
+    }
+
+    // a receive batch of sealed packets, verified one by one, then at once.
+    constexpr size_t kBatch = 64;
+    std::vector<char> batch(kBatch * packet_size);
+    std::vector<const char *> packets(kBatch);
+    std::vector<size_t> lengths(kBatch, packet_size);
+    for (size_t i = 0; i < kBatch; ++i)
+    {
+        char *packet = batch.data() + i * packet_size;
+        memcpy(packet, data.data() + i, packet_size);
+        auto *header = (zeno::net::PacketHeader *) packet;
+        header->packet_length = packet_size;
+        zeno::net::SealPacket(packet, packet_size);
+        packets[i] = packet;
+    }
+    uint64_t rounds = kBytesPerRun / (kBatch * packet_size);
+    uint64_t failed = 0;
+    measure("VerifyPacket, " + std::to_string(packet_size) + " B",
+            rounds * kBatch * packet_size,
+            [&]() {
+                for (uint64_t r = 0; r < rounds; ++r)
+                {
+                    for (size_t i = 0; i < kBatch; ++i)
+                    {
+                        bool ok =
+                            zeno::net::VerifyPacket(packets[i], packet_size);
+                        failed += ok ? 0 : 1;
+                    }
+                }
+            });
+    bool ok[kBatch];
+    measure("VerifyPackets of " + std::to_string(kBatch) + ", " +
+                std::to_string(packet_size) + " B",
+            rounds * kBatch * packet_size,
+            [&]() {
+                for (uint64_t r = 0; r < rounds; ++r)
+                {
+                    failed += zeno::net::VerifyPackets(
+                        packets.data(), lengths.data(), kBatch, ok);
+                }
+            });
+    check(failed == 0, "%" PRIu64 " sealed packets failed", failed);
+
+    dinfo("checksum %u", sink);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "zeno/disk/logger.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "zeno/debug.hpp"
+#include "zeno/disk/replay.hpp"
+#include "zeno/disk/wal.hpp"
+#include "zeno/placement.hpp"
+#include "zeno/smart.hpp"
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5 || argc > 9)
+    {
+        std::cerr << "Usage: logger <file> <thread> <size> <seconds> "
+                     "[append|inplace [queue_depth] [aio|uring|sqpoll] | "
+                     "wal [flush_kb] [delay_us] [segment_mb] | replay [read_mb]]\n"
+                     "wal with a segment_mb writes <file>.<index> segments, "
+                     "truncated once a second.\n"
+                     "replay reads a wal back with <thread> threads, "
+                     "ignoring <size> and <seconds>.\n"
+                     "ZENO_PLACEMENT=none|compact|spread|<cpu list> pins the "
+                     "writer threads.\n";
+        return 1;
+    }
+    std::string file = argv[1];
+    int thread_nr = std::stoi(argv[2]);
+    int size = std::stoi(argv[3]);
+    int seconds = std::stoi(argv[4]);
+    std::string mode = argc >= 6 ? argv[5] : "append";
+    check(mode == "append" || mode == "inplace" || mode == "wal" ||
+              mode == "replay",
+          "unknown mode %s",
+          mode.c_str());
+    bool pipeline = mode == "append" || mode == "inplace";
+    size_t queue_depth = argc >= 7 && pipeline ? std::stoul(argv[6]) : 1;
+    auto engine = argc == 8 && pipeline ? zeno::disk::ParseEngine(argv[7])
+                                        : zeno::disk::Engine::Aio;
+
+    auto placement = zeno::Placement::FromEnv();
+    if (mode == "replay")
+    {
+        zeno::disk::ReplayOptions options;
+        options.threads = thread_nr;
+        if (argc >= 7)
+        {
+            options.read_size = std::stoul(argv[6]) * zeno::define::MiB;
+        }
+        std::atomic<uint64_t> replayed{0};
+        auto start = std::chrono::steady_clock::now();
+        auto count = [&replayed](zeno::disk::Lsn, const char *, size_t) {
+            replayed.fetch_add(1, std::memory_order_relaxed);
+        };
+        bool segmented = !zeno::disk::ListSegments(file).empty();
+        auto tail = segmented
+                        ? zeno::disk::ReplaySegments(file, count, options)
+                        : zeno::disk::ReplayLog(file, count, options);
+        double seconds_taken =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          start)
+                .count();
+        info("replayed %" PRIu64 " records, Lsn %" PRIu64 " to %" PRIu64
+             ", %s in %.3lf s: %s/s, %s. The log goes on at offset %" PRIu64,
+             replayed.load(),
+             tail.first_lsn,
+             tail.last_lsn,
+             zeno::smart::toSize(tail.bytes).c_str(),
+             seconds_taken,
+             zeno::smart::toSize(tail.bytes / seconds_taken).c_str(),
+             zeno::smart::toOps(replayed.load() / seconds_taken).c_str(),
+             tail.end);
+    }
+    else if (mode == "wal")
+    {
+        zeno::disk::WalOptions options;
+        if (argc >= 7)
+        {
+            options.flush_size = std::stoul(argv[6]) * zeno::define::KiB;
+        }
+        if (argc >= 8)
+        {
+            options.max_delay_us = std::stoul(argv[7]);
+        }
+        if (argc == 9)
+        {
+            options.segment_size = std::stoul(argv[8]) * zeno::define::MiB;
+        }
+        zeno::disk::WriteAheadLog wal(file, options);
+        wal.Run(thread_nr, size, seconds, placement);
+    }
+    else if (mode == "append")
+    {
+        zeno::disk::Logger logger(file, engine);
+        logger.Run(thread_nr, size, seconds, placement, queue_depth);
+    }
+    else
+    {
+        zeno::disk::InPlaceWrite writer(file, engine);
+        writer.Run(thread_nr, size, seconds, placement, queue_depth);
+    }
+    return 0;
+}
@@ -19,26 +19,90 @@
 
 #include "zeno/debug.hpp"
 #include "zeno/net/parser.hpp"
+#include "zeno/net/sharded-server.hpp"
+#include "zeno/net/timestamps.hpp"
+#include "zeno/placement.hpp"
 
 int main(int argc, char *argv[])
 {
     try
     {
-        if (argc != 3)
+        // a trailing "gso" turns on UDP segmentation offload.
+        bool gso = argc > 2 && std::string(argv[argc - 1]) == "gso";
+        if (gso)
         {
-            std::cerr << "Usage: async_udp_echo_server <port> <thread>\n";
+            argc--;
+        }
+        if (argc < 3 || argc > 7)
+        {
+            std::cerr << "Usage: async_udp_echo_server <port> <thread> "
+                         "[strand [max_inflight] [newest|client|bucket] "
+                         "[client_rate] | sharded [batch] [asio|uring|busy] "
+                         "[busy_poll_us] [gso]]\n"
+                         "ZENO_PLACEMENT=none|compact|spread|<cpu list> "
+                         "pins the worker threads.\n"
+                         "ZENO_TIMESTAMPS=<n> breaks the latency of one "
+                         "request in n down by stage.\n"
+                         "ZENO_CHECKSUM=1 drops the requests with a bad "
+                         "checksum, in sharded asio or busy mode.\n";
             return 1;
         }
+        auto placement = zeno::Placement::FromEnv();
+        std::string mode = argc >= 4 ? argv[3] : "strand";
+
+        if (mode == "sharded")
+        {
+            zeno::net::ServerOptions options;
+            options.segmentation_offload = gso;
+            options.timestamp_sample = zeno::net::LatencyBreakdown::FromEnv();
+            options.verify_checksum = zeno::net::ChecksumFromEnv();
+            if (argc >= 5)
+            {
+                options.batch_size = std::stoi(argv[4]);
+            }
+            if (argc >= 6)
+            {
+                options.backend = zeno::net::ParseBackend(argv[5]);
+            }
+            if (argc == 7)
+            {
+                options.busy_poll_us = std::stoi(argv[6]);
+                options.prefer_busy_poll = options.busy_poll_us > 0;
+            }
+            zeno::net::ShardedServer s(
+                std::atoi(argv[1]), std::stoi(argv[2]), options, placement);
+            s.run();
+            return 0;
+        }
+        check(mode == "strand", "unknown mode %s", mode.c_str());
+
+        zeno::net::ServerOptions options;
+        options.timestamp_sample = zeno::net::LatencyBreakdown::FromEnv();
+        if (argc >= 5)
+        {
+            options.admission.max_inflight = std::stoul(argv[4]);
+        }
+        if (argc >= 6)
+        {
+            options.admission.policy = zeno::net::ParseShedPolicy(argv[5]);
+        }
+        if (argc >= 7)
+        {
+            options.admission.client_rate = std::stod(argv[6]);
+        }
 
         boost::asio::io_context io_context;
 
-        zeno::net::MultithreadServer s(io_context, std::atoi(argv[1]));
+        zeno::net::MultithreadServer s(io_context, std::atoi(argv[1]), options);
         size_t thread_nr = std::stoi(argv[2]);
 
         boost::thread_group tg;
         for (size_t i = 0; i < thread_nr; ++i)
         {
-            tg.create_thread([&]() { io_context.run(); });
+            tg.create_thread([&, i]() {
+                placement.pin(i);
+                io_context.run();
+            });
         }
 
         tg.join_all();
@@ -15,20 +15,76 @@
 #include <iostream>
 
 #include "zeno/debug.hpp"
+#include "zeno/net/busy-poll-server.hpp"
+#include "zeno/net/shm-server.hpp"
+#include "zeno/net/timestamps.hpp"
+#include "zeno/net/uring-server.hpp"
 
 int main(int argc, char *argv[])
 {
     try
     {
-        if (argc != 2)
+        // a trailing "gso" turns on UDP segmentation offload.
+        bool gso = argc > 2 && std::string(argv[argc - 1]) == "gso";
+        if (gso)
         {
-            std::cerr << "Usage: async_udp_echo_server <port>\n";
+            argc--;
+        }
+        if (argc < 2 || argc > 6)
+        {
+            std::cerr << "Usage: async_udp_echo_server <port> [batch] "
+                         "[asio|uring|busy|shm] [busy_poll_us] [cpu] [gso]\n"
+                         "ZENO_TIMESTAMPS=<n> breaks the latency of one "
+                         "request in n down by stage.\n"
+                         "ZENO_CHECKSUM=1 drops the requests with a bad "
+                         "checksum.\n";
             return 1;
         }
 
+        zeno::net::ServerOptions options;
+        options.segmentation_offload = gso;
+        options.timestamp_sample = zeno::net::LatencyBreakdown::FromEnv();
+        options.verify_checksum = zeno::net::ChecksumFromEnv();
+        if (argc >= 3)
+        {
+            options.batch_size = std::stoi(argv[2]);
+        }
+        if (argc >= 4)
+        {
+            options.backend = zeno::net::ParseBackend(argv[3]);
+        }
+        if (argc >= 5)
+        {
+            options.busy_poll_us = std::stoi(argv[4]);
+            options.prefer_busy_poll = options.busy_poll_us > 0;
+        }
+        if (argc == 6)
+        {
+            options.cpu = std::stoi(argv[5]);
+        }
+
+        if (options.backend == zeno::net::Backend::IoUring)
+        {
+            zeno::net::UringServer s(std::atoi(argv[1]), options);
+            s.run();
+            return 0;
+        }
+        if (options.backend == zeno::net::Backend::BusyPoll)
+        {
+            zeno::net::BusyPollServer s(std::atoi(argv[1]), options);
+            s.run();
+            return 0;
+        }
+        if (options.backend == zeno::net::Backend::Shm)
+        {
+            zeno::net::ShmServer<> s(std::atoi(argv[1]), options);
+            s.run();
+            return 0;
+        }
+
         boost::asio::io_context io_context;
 
-        zeno::net::server s(io_context, std::atoi(argv[1]));
+        zeno::net::server s(io_context, std::atoi(argv[1]), options);
 
         io_context.run();
     }
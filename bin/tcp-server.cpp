@@ -0,0 +1,53 @@
+#include "zeno/net/tcp-server.hpp"
+
+#include <boost/asio.hpp>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/placement.hpp"
+
+int main(int argc, char *argv[])
+{
+    try
+    {
+        if (argc < 2 || argc > 3)
+        {
+            std::cerr << "Usage: tcp_echo_server <port> [thread]\n"
+                         "ZENO_PLACEMENT=none|compact|spread|<cpu list> "
+                         "pins the server threads.\n";
+            return 1;
+        }
+        short port = std::atoi(argv[1]);
+        size_t thread_nr = argc == 3 ? std::stoi(argv[2]) : 1;
+        auto placement = zeno::Placement::FromEnv();
+
+        // one server per thread on a shared port, like ShardedServer.
+        zeno::net::ServerOptions options;
+        options.reuse_port = thread_nr > 1;
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < thread_nr; ++i)
+        {
+            threads.emplace_back([&, i]() {
+                placement.pin(i);
+                boost::asio::io_context io_context(1);
+                zeno::net::TcpServer<> s(io_context, port, options);
+                io_context.run();
+            });
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << "Exception: " << e.what() << "\n";
+    }
+
+    return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file helpers to place threads on CPUs and to spin politely
+ */
+#ifndef CPU_H_
+#define CPU_H_
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+/**
+ * @brief pin the calling thread to @p cpu
+ *
+ * @return whether the affinity was applied. A failure is only a warning:
+ * the thread keeps running wherever the scheduler puts it.
+ */
+inline bool PinThread(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (ret != 0)
+    {
+        warn("failed to pin thread to CPU %d: %s", cpu, strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief hint the CPU that we are in a spin loop, which frees resources for
+ * the sibling hyperthread and saves power
+ */
+inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * @brief CPU time consumed by the calling thread, user and system
+ */
+inline uint64_t ThreadCpuNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief normalize a thread's work by the CPU it burnt, to compare transports
+ * in ops/core and bytes/core rather than in wall-clock throughput
+ *
+ * Must be used from the measured thread only. The first report() only
+ * starts the clock, so the meter can be built by another thread.
+ */
+class CpuMeter
+{
+public:
+    void add(uint64_t ops, uint64_t bytes)
+    {
+        ops_ += ops;
+        bytes_ += bytes;
+    }
+    /**
+     * @brief log the ops and bytes per CPU-second since the last report, if
+     * any work was done
+     */
+    void report(const char *name)
+    {
+        uint64_t now = ThreadCpuNs();
+        double cpu = (now - last_ns_) / 1e9;
+        if (last_ns_ != 0 && ops_ != 0 && cpu > 0)
+        {
+            info("%s: %" PRIu64 " ops, %" PRIu64
+                 " bytes on %.2lf core, %.0lf ops/core, %.2lf MB/s/core",
+                 name,
+                 ops_,
+                 bytes_,
+                 cpu,
+                 ops_ / cpu,
+                 bytes_ / cpu / 1e6);
+        }
+        ops_ = 0;
+        bytes_ = 0;
+        last_ns_ = now;
+    }
+
+private:
+    uint64_t last_ns_{0};
+    uint64_t ops_{0};
+    uint64_t bytes_{0};
+};
+}  // namespace zeno
+
+#endif
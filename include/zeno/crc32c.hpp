@@ -0,0 +1,313 @@
+/**
+ * @file CRC32C (Castagnoli), with the SSE4.2 crc32 instruction when the CPU
+ * has it and a slicing-by-8 table otherwise
+ */
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+namespace zeno
+{
+namespace detail
+{
+// the Castagnoli polynomial, bit-reflected
+constexpr uint32_t kCrc32cPoly = 0x82f63b78;
+
+struct Crc32cTables
+{
+    Crc32cTables()
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ (crc & 1 ? kCrc32cPoly : 0);
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            for (int k = 1; k < 8; ++k)
+            {
+                uint32_t prev = table[k - 1][i];
+                table[k][i] = (prev >> 8) ^ table[0][prev & 0xff];
+            }
+        }
+    }
+
+    uint32_t table[8][256];
+};
+
+inline const Crc32cTables &GetCrc32cTables()
+{
+    static const Crc32cTables tables;
+    return tables;
+}
+
+/**
+ * @brief the raw CRC register after @p data, without the pre and post
+ * inversions, eight bytes per step
+ */
+inline uint32_t Crc32cSlicing8(uint32_t crc, const uint8_t *p, size_t length)
+{
+    const auto &t = GetCrc32cTables().table;
+    for (; length != 0 && ((uintptr_t) p & 7) != 0; --length)
+    {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    for (; length >= 8; length -= 8, p += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^
+              t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+              t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^
+              t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+    }
+    for (; length != 0; --length)
+    {
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+/**
+ * @return x^n mod P, bit-reflected: what multiplies a CRC register to
+ * append n zero bits
+ */
+inline uint32_t Crc32cXPow(size_t n)
+{
+    uint32_t value = 0x80000000;  // x^0
+    for (size_t i = 0; i < n; ++i)
+    {
+        value = (value >> 1) ^ (value & 1 ? kCrc32cPoly : 0);
+    }
+    return value;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) inline uint32_t Crc32cSse42(
+    uint32_t crc, const uint8_t *p, size_t length)
+{
+    for (; length != 0 && ((uintptr_t) p & 7) != 0; --length)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    uint64_t crc64 = crc;
+    for (; length >= 8; length -= 8, p += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = (uint32_t) crc64;
+    for (; length != 0; --length)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+
+/**
+ * @brief shift CRC registers by a fixed number of bytes with one carry-less
+ * multiply each, to merge the CRCs of consecutive blocks
+ *
+ * The product of two reflected 32-bit polynomials comes out of pclmulqdq
+ * multiplied by x, and crc32 of a 64-bit word multiplies it by x^32, so
+ * shifting by n bytes takes the constant x^(8n - 33).
+ */
+struct Crc32cShift
+{
+    explicit Crc32cShift(size_t bytes)
+        : once(Crc32cXPow(8 * bytes - 33)), twice(Crc32cXPow(16 * bytes - 33))
+    {
+    }
+
+    /**
+     * @return @p a shifted by two blocks, xor @p b shifted by one
+     */
+    __attribute__((target("sse4.2,pclmul"))) uint32_t merge(uint32_t a,
+                                                            uint32_t b) const
+    {
+        __m128i product = _mm_xor_si128(
+            _mm_clmulepi64_si128(
+                _mm_cvtsi32_si128(a), _mm_cvtsi32_si128(twice), 0),
+            _mm_clmulepi64_si128(
+                _mm_cvtsi32_si128(b), _mm_cvtsi32_si128(once), 0));
+        return (uint32_t) _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+    }
+
+    uint32_t once;
+    uint32_t twice;
+};
+
+/**
+ * @brief three independent crc32 streams, merged with pclmulqdq
+ *
+ * crc32 has a latency of three cycles but a throughput of one per cycle:
+ * a single dependent chain leaves two thirds of the unit idle. Long
+ * buffers are cut into three blocks of kLongBlock bytes, then kShortBlock,
+ * whose CRCs are computed side by side and merged.
+ */
+__attribute__((target("sse4.2,pclmul"))) inline uint32_t Crc32cInterleaved(
+    uint32_t crc, const uint8_t *p, size_t length)
+{
+    constexpr size_t kLongBlock = 4096;
+    constexpr size_t kShortBlock = 256;
+    static const Crc32cShift long_shift(kLongBlock);
+    static const Crc32cShift short_shift(kShortBlock);
+
+    for (; length != 0 && ((uintptr_t) p & 7) != 0; --length)
+    {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    for (size_t block = kLongBlock; block >= kShortBlock;
+         block = block == kLongBlock ? kShortBlock : 0)
+    {
+        const Crc32cShift &shift =
+            block == kLongBlock ? long_shift : short_shift;
+        for (; length >= 3 * block; length -= 3 * block, p += 3 * block)
+        {
+            uint64_t a = crc, b = 0, c = 0;
+            for (size_t i = 0; i < block; i += 8)
+            {
+                uint64_t wa, wb, wc;
+                memcpy(&wa, p + i, 8);
+                memcpy(&wb, p + block + i, 8);
+                memcpy(&wc, p + 2 * block + i, 8);
+                a = _mm_crc32_u64(a, wa);
+                b = _mm_crc32_u64(b, wb);
+                c = _mm_crc32_u64(c, wc);
+            }
+            crc = shift.merge((uint32_t) a, (uint32_t) b) ^ (uint32_t) c;
+        }
+    }
+    return Crc32cSse42(crc, p, length);
+}
+
+/**
+ * @brief the raw registers of @p n buffers, three at a time side by side
+ */
+__attribute__((target("sse4.2"))) inline void Crc32cSse42Batch(
+    uint32_t *crcs, const char *const *data, const size_t *lengths, size_t n)
+{
+    size_t i = 0;
+    for (; i + 3 <= n; i += 3)
+    {
+        size_t common = lengths[i];
+        common = lengths[i + 1] < common ? lengths[i + 1] : common;
+        common = lengths[i + 2] < common ? lengths[i + 2] : common;
+        common &= ~(size_t) 7;
+        uint64_t a = crcs[i], b = crcs[i + 1], c = crcs[i + 2];
+        for (size_t pos = 0; pos < common; pos += 8)
+        {
+            uint64_t wa, wb, wc;
+            memcpy(&wa, data[i] + pos, 8);
+            memcpy(&wb, data[i + 1] + pos, 8);
+            memcpy(&wc, data[i + 2] + pos, 8);
+            a = _mm_crc32_u64(a, wa);
+            b = _mm_crc32_u64(b, wb);
+            c = _mm_crc32_u64(c, wc);
+        }
+        uint64_t raw[3] = {a, b, c};
+        for (size_t k = 0; k < 3; ++k)
+        {
+            crcs[i + k] = Crc32cSse42((uint32_t) raw[k],
+                                      (const uint8_t *) data[i + k] + common,
+                                      lengths[i + k] - common);
+        }
+    }
+    for (; i < n; ++i)
+    {
+        crcs[i] =
+            Crc32cSse42(crcs[i], (const uint8_t *) data[i], lengths[i]);
+    }
+}
+#endif
+}  // namespace detail
+
+/**
+ * @brief whether Crc32c() runs on the crc32 and pclmulqdq instructions
+ */
+inline bool Crc32cAccelerated()
+{
+#if defined(__x86_64__)
+    static const bool accelerated =
+        __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+    return accelerated;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @return the CRC32C of @p data, continuing @p crc, the CRC32C of the bytes
+ * before. Crc32c(b, m, Crc32c(a, n)) is the CRC32C of a then b.
+ */
+inline uint32_t Crc32c(const void *data, size_t length, uint32_t crc = 0)
+{
+#if defined(__x86_64__)
+    if (Crc32cAccelerated())
+    {
+        return ~detail::Crc32cInterleaved(
+            ~crc, (const uint8_t *) data, length);
+    }
+#endif
+    return ~detail::Crc32cSlicing8(~crc, (const uint8_t *) data, length);
+}
+
+/**
+ * @brief Crc32c() without the hardware, whatever the CPU
+ */
+inline uint32_t Crc32cPortable(const void *data,
+                               size_t length,
+                               uint32_t crc = 0)
+{
+    return ~detail::Crc32cSlicing8(~crc, (const uint8_t *) data, length);
+}
+
+/**
+ * @brief crcs[i] = Crc32c(data[i], lengths[i], crcs[i]) for i < @p n
+ *
+ * Short buffers, like datagrams, are too short to split: the hardware path
+ * rather interleaves three of them, which hides the latency of crc32 as
+ * well as Crc32c() does on one long buffer.
+ */
+inline void Crc32cBatch(uint32_t *crcs,
+                        const char *const *data,
+                        const size_t *lengths,
+                        size_t n)
+{
+#if defined(__x86_64__)
+    if (Crc32cAccelerated())
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            crcs[i] = ~crcs[i];
+        }
+        detail::Crc32cSse42Batch(crcs, data, lengths, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            crcs[i] = ~crcs[i];
+        }
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; ++i)
+    {
+        crcs[i] = Crc32c(data[i], lengths[i], crcs[i]);
+    }
+}
+}  // namespace zeno
+
+#endif
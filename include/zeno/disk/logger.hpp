@@ -2,18 +2,56 @@
 #define DISK_WRITER_H
 
 #include <inttypes.h>
-#include <libaio.h>
 
 #include <atomic>
-#include <thread>
-#include <vector>
+#include <string>
 
+#include "zeno/debug.hpp"
 #include "zeno/define.hpp"
+#include "zeno/placement.hpp"
 
 namespace zeno
 {
 namespace disk
 {
+/**
+ * @brief how the benchmarks submit their writes
+ */
+enum class Engine
+{
+    // libaio: io_submit and io_getevents
+    Aio,
+    // io_uring, with registered buffers and a fixed file
+    IoUring,
+    // the same, with a kernel thread polling the submission ring
+    IoUringSqpoll,
+};
+
+inline Engine ParseEngine(const std::string &name)
+{
+    if (name == "aio")
+    {
+        return Engine::Aio;
+    }
+    if (name == "uring")
+    {
+        return Engine::IoUring;
+    }
+    check(name == "sqpoll",
+          "unknown engine %s, expect aio, uring or sqpoll",
+          name.c_str());
+    return Engine::IoUringSqpoll;
+}
+
+/**
+ * @brief append benchmark: every write goes to the next offset of the file
+ *
+ * Each thread keeps queue_depth writes in flight on its own io_context or
+ * io_uring, with one buffer per write: all its free slots are submitted by
+ * a single syscall, and every completion reaped frees one. Raise
+ * queue_depth until the IOPS stop growing to find the saturation point of a
+ * device, and compare the engines by their syscalls and CPU time per write.
+ */
 class Logger
 {
 public:
@@ -21,26 +59,36 @@ public:
     static constexpr size_t kMaxEvent = 1024;
     static constexpr size_t kAIOAlignment = 512;
 
-    Logger(std::string filename);
+    Logger(std::string filename, Engine engine = Engine::Aio);
     ~Logger();
     /**
      * @brief run the benchmark
      *
      * @param threads number of threads to run the benchmark
      * @param seconds duration of the benchmark
+     * @param placement where to pin the threads. Each one allocates its
+     * buffers after pinning, so on its own NUMA node.
+     * @param queue_depth writes in flight per thread, at most kMaxEvent
      *
      */
-    void Run(int threads, int size, int seconds);
+    void Run(int threads,
+             int size,
+             int seconds,
+             const Placement &placement = Placement(),
+             size_t queue_depth = 1);
 
 private:
-    std::atomic<uint64_t> count_{0};
-    std::atomic<bool> stop_{false};
-    std::vector<std::thread> threads_;
+    std::atomic<uint64_t> offset_{0};
     int fd_{-1};
-    io_context_t ctx_;
-    std::atomic<size_t> offset_{0};
+    Engine engine_;
 };
 
+/**
+ * @brief overwrite benchmark: every write slot rewrites its own block
+ *
+ * The same pipeline as Logger, but slot i of thread t always writes at
+ * (t * queue_depth + i) * size, so that writes in flight never overlap.
+ */
 class InPlaceWrite
 {
 public:
@@ -48,23 +96,27 @@ public:
     static constexpr size_t kMaxEvent = 1024;
     static constexpr size_t kAIOAlignment = 512;
 
-    InPlaceWrite(std::string filename);
+    InPlaceWrite(std::string filename, Engine engine = Engine::Aio);
     ~InPlaceWrite();
     /**
      * @brief run the benchmark
      *
      * @param threads number of threads to run the benchmark
      * @param seconds duration of the benchmark
+     * @param placement where to pin the threads. Each one allocates its
+     * buffers after pinning, so on its own NUMA node.
+     * @param queue_depth writes in flight per thread, at most kMaxEvent
      *
      */
-    void Run(int threads, int size, int seconds);
+    void Run(int threads,
+             int size,
+             int seconds,
+             const Placement &placement = Placement(),
+             size_t queue_depth = 1);
 
 private:
-    std::atomic<uint64_t> count_{0};
-    std::atomic<bool> stop_{false};
-    std::vector<std::thread> threads_;
     int fd_{-1};
-    io_context_t ctx_;
+    Engine engine_;
 };
 
 }  // namespace disk
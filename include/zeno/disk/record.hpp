@@ -0,0 +1,84 @@
+#ifndef DISK_RECORD_H
+#define DISK_RECORD_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#include "zeno/crc32c.hpp"
+#include "zeno/define.hpp"
+
+namespace zeno
+{
+namespace disk
+{
+/**
+ * @brief the log sequence number of a record, from 1 on
+ */
+using Lsn = uint64_t;
+
+/**
+ * @brief the unit of the log on disk: groups start on a block boundary
+ */
+constexpr size_t kLogBlockSize = 4 * define::KiB;
+constexpr uint32_t kGroupMagic = 0x5a4c4f47;  // "GOLZ"
+
+/**
+ * @brief the header of a group of records, at the start of its first block
+ *
+ * The records follow back to back, then zeros up to the end of the block.
+ * A group is written at once: it is in the log only if it and all its
+ * records check out.
+ *
+ * Every WriteAheadLog draws a new epoch when it opens the file, and its first
+ * group names the epoch of the last group it recovered as its parent. The
+ * groups after it name their own epoch. A scan thus stops at the groups an
+ * older writer left past the end of the log, even if their Lsn follow.
+ */
+struct GroupHeader
+{
+    uint32_t magic;
+    // CRC32C of the rest of the header
+    uint32_t checksum;
+    uint32_t epoch;
+    // the epoch of the group before, 0 for the first group of the log
+    uint32_t parent;
+    // bytes of records after the header
+    uint32_t size;
+    uint32_t records;
+    Lsn first_lsn;
+} __attribute__((packed));
+
+/**
+ * @brief the header of every record, followed by its payload
+ */
+struct RecordHeader
+{
+    uint32_t length;
+    // CRC32C of the lsn and the payload
+    uint32_t checksum;
+    Lsn lsn;
+} __attribute__((packed));
+
+inline uint32_t GroupChecksum(const GroupHeader &header)
+{
+    constexpr size_t kSkip = offsetof(GroupHeader, epoch);
+    return Crc32c((const char *) &header + kSkip, sizeof(header) - kSkip);
+}
+
+inline uint32_t RecordChecksum(Lsn lsn, const void *data, size_t length)
+{
+    return Crc32c(data, length, Crc32c(&lsn, sizeof(lsn)));
+}
+
+/**
+ * @brief the bytes a group of @p size bytes of records takes on disk
+ */
+inline size_t GroupSpan(size_t size)
+{
+    size_t bytes = sizeof(GroupHeader) + size;
+    return (bytes + kLogBlockSize - 1) / kLogBlockSize * kLogBlockSize;
+}
+}  // namespace disk
+}  // namespace zeno
+
+#endif
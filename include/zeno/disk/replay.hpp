@@ -0,0 +1,97 @@
+#ifndef DISK_REPLAY_H
+#define DISK_REPLAY_H
+
+#include <inttypes.h>
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "zeno/define.hpp"
+#include "zeno/disk/record.hpp"
+
+namespace zeno
+{
+namespace disk
+{
+/**
+ * @brief called on every record of the log, from several threads at once
+ *
+ * The records of a group arrive in Lsn order on one thread. A read of the
+ * log is replayed only once all the one before is.
+ */
+using Replay = std::function<void(Lsn lsn, const char *data, size_t length)>;
+
+struct ReplayOptions
+{
+    // threads checking and replaying the groups of a read
+    size_t threads{4};
+    /**
+     * bytes per O_DIRECT read, a multiple of kLogBlockSize, which bounds the
+     * size of a group. The next read runs while the groups of the last one
+     * are checked.
+     */
+    size_t read_size{16 * define::MiB};
+};
+
+/**
+ * @brief what a scan found in the log
+ */
+struct LogTail
+{
+    // the first and last records of the log, 0 if it is empty
+    Lsn first_lsn{0};
+    Lsn last_lsn{0};
+    // the epoch of the last group
+    uint32_t epoch{0};
+    // right after the last group, in the file it was found in: where the log
+    // goes on
+    uint64_t end{0};
+    uint64_t groups{0};
+    uint64_t records{0};
+    uint64_t bytes{0};
+    // the scan stopped on a torn or corrupt group, not a clean end
+    bool torn{false};
+};
+
+/**
+ * @brief scan the log in @p fd, opened with O_DIRECT, calling @p replay on
+ * every record if set, and find where it ends
+ *
+ * The groups are found by their headers, then checked and replayed in
+ * parallel. A group that does not check out ends the log, with all the
+ * groups after it: none of their records was ever reported durable.
+ *
+ * @param after the log found so far, in the segments before @p fd: the
+ * groups must go on from it, unless it is empty. The returned tail adds the
+ * groups of @p fd to it, its end is 0 if there is none.
+ */
+LogTail ReplayLog(int fd,
+                  const Replay &replay,
+                  const ReplayOptions &options = ReplayOptions(),
+                  const LogTail &after = LogTail());
+/**
+ * @brief ReplayLog() on the file @p filename
+ */
+LogTail ReplayLog(const std::string &filename,
+                  const Replay &replay,
+                  const ReplayOptions &options = ReplayOptions());
+
+/**
+ * @brief the segments of the log @p prefix, the files <prefix>.<index>, as
+ * their index and path sorted by index
+ */
+std::vector<std::pair<uint64_t, std::string>> ListSegments(
+    const std::string &prefix);
+/**
+ * @brief ReplayLog() on the segments of the log @p prefix, one after the
+ * other, up to the end of the log
+ */
+LogTail ReplaySegments(const std::string &prefix,
+                       const Replay &replay,
+                       const ReplayOptions &options = ReplayOptions());
+}  // namespace disk
+}  // namespace zeno
+
+#endif
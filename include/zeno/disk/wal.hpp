@@ -0,0 +1,287 @@
+#ifndef DISK_WAL_H
+#define DISK_WAL_H
+
+#include <inttypes.h>
+#include <libaio.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zeno/define.hpp"
+#include "zeno/disk/record.hpp"
+#include "zeno/disk/replay.hpp"
+#include "zeno/placement.hpp"
+
+namespace zeno
+{
+namespace disk
+{
+/**
+ * @brief knobs of a WriteAheadLog
+ */
+struct WalOptions
+{
+    /**
+     * a group is written once it holds flush_size bytes, which also bounds
+     * the size of a record.
+     */
+    size_t flush_size{256 * define::KiB};
+    /**
+     * ... or once its first record waited max_delay_us, which bounds the
+     * commit latency under light load.
+     */
+    uint64_t max_delay_us{200};
+    /**
+     * max number of groups being written at once. Appenders wait beyond.
+     */
+    size_t queue_depth{4};
+    /**
+     * open with O_DSYNC, so that a completed write is on stable storage and
+     * not only in the cache of the device.
+     */
+    bool dsync{true};
+    /**
+     * split the log into the files <filename>.<index> of segment_size bytes,
+     * or keep it all in filename if 0.
+     */
+    uint64_t segment_size{0};
+    /**
+     * segments fallocated ahead of the one being written, so that a rotation
+     * does not wait for the filesystem.
+     */
+    size_t preallocate{2};
+    /**
+     * how the log already in the file is read back on open.
+     */
+    ReplayOptions replay;
+};
+
+/**
+ * @brief what a WriteAheadLog did since it was built
+ */
+struct WalStats
+{
+    uint64_t records{0};
+    uint64_t groups{0};
+    uint64_t bytes{0};
+    // the bytes written to pad the groups to whole blocks
+    uint64_t padding{0};
+    uint64_t errors{0};
+    uint64_t rotations{0};
+    // the rotations which waited for a segment to be preallocated
+    uint64_t rotation_stalls{0};
+    // the segments dropped by Truncate()
+    uint64_t truncated{0};
+};
+
+/**
+ * @brief a durable append-only log with group commit, on libaio and
+ * O_DIRECT
+ *
+ * Any thread may Append() a record: it gets the next Lsn and is copied into
+ * the open group, a block-aligned buffer. A flusher thread writes the group
+ * with a single io_submit once it holds flush_size bytes or its first
+ * record waited max_delay_us, so that one write commits many records. Up to
+ * queue_depth groups are in flight.
+ *
+ * A record is durable once its group and all the groups before it are
+ * written. Completions are delivered in Lsn order, on the completion
+ * thread: callbacks must be short and must not Append().
+ *
+ * Each group starts on a block boundary with a GroupHeader, its tail padded
+ * with zeros. On open, the log already in the file is scanned up to its last
+ * whole group, and appends go on from there.
+ *
+ * With a segment_size, the log is a series of segment files and a group goes
+ * to the next one when it does not fit in the current one. A thread keeps
+ * the next segments fallocated, so that the writes neither allocate blocks
+ * nor grow the file. Truncate() drops the segments the consumers are done
+ * with, and recycles them as the next ones: the disk used stays bounded.
+ */
+class WriteAheadLog
+{
+public:
+    using Callback = std::function<void(Lsn lsn, int error)>;
+
+    static constexpr size_t kBlockSize = kLogBlockSize;
+    static constexpr size_t kMaxEvent = 1024;
+
+    /**
+     * @brief open the log in @p filename, calling @p replay, if set, on every
+     * record it already holds before anything is appended
+     */
+    WriteAheadLog(std::string filename,
+                  const WalOptions &options = WalOptions(),
+                  const Replay &replay = nullptr);
+    /**
+     * @brief write what is left and wait for it
+     */
+    ~WriteAheadLog();
+    WriteAheadLog(const WriteAheadLog &) = delete;
+    WriteAheadLog &operator=(const WriteAheadLog &) = delete;
+
+    /**
+     * @brief append a record of @p length bytes, calling @p callback with its
+     * Lsn and 0, or a negative errno, once durable
+     *
+     * Blocks only while queue_depth groups are in flight and the open one is
+     * full.
+     */
+    Lsn Append(const void *data, size_t length, Callback callback);
+    /**
+     * @brief Append(), with a future of the Lsn, which throws a
+     * std::system_error if the write failed
+     */
+    std::future<Lsn> Append(const void *data, size_t length);
+    /**
+     * @brief write the open group now, without waiting for it
+     */
+    void Flush();
+    /**
+     * @brief drop the segments which only hold records up to @p lsn, once the
+     * consumers checkpointed it, but never the one being written
+     *
+     * @return the number of segments dropped
+     */
+    size_t Truncate(Lsn lsn);
+    /**
+     * @brief every record up to this one is durable
+     */
+    Lsn durable_lsn() const
+    {
+        return durable_lsn_.load(std::memory_order_acquire);
+    }
+    /**
+     * @brief what the scan found in the file on open
+     */
+    const LogTail &recovered() const
+    {
+        return recovered_;
+    }
+    /**
+     * @brief only valid once the log is idle
+     */
+    const WalStats &stats() const
+    {
+        return stats_;
+    }
+
+    /**
+     * @brief run the benchmark: @p threads append records of @p size bytes
+     * for @p seconds, each with up to kBenchWindow awaiting commit
+     */
+    void Run(int threads,
+             int size,
+             int seconds,
+             const Placement &placement = Placement());
+
+private:
+    static constexpr size_t kBenchWindow = 64;
+
+    struct Group
+    {
+        char *buffer{nullptr};
+        size_t size{0};
+        // appenders that reserved room but still copy their record
+        std::atomic<size_t> writers{0};
+        std::vector<std::pair<Lsn, Callback>> callbacks;
+        uint64_t opened_ns{0};
+        int fd{-1};
+        iocb cb;
+        bool done{false};
+        int error{0};
+    };
+
+    struct Segment
+    {
+        uint64_t index;
+        int fd;
+        // the first record written to it, 0 if none yet
+        Lsn first_lsn;
+    };
+
+    std::string segment_path(uint64_t index) const;
+    int open_file(const std::string &path);
+    /**
+     * @brief allocate the blocks of a segment
+     */
+    void preallocate(int fd);
+    /**
+     * @brief find the log in the file or in the segments, and go on from its
+     * end
+     */
+    void recover(const Replay &replay);
+    Group *open_group(std::unique_lock<std::mutex> &lock);
+    /**
+     * @brief go on to the next preallocated segment
+     */
+    void rotate(std::unique_lock<std::mutex> &lock);
+    /**
+     * @brief write the sealed @p group, @p padded bytes at @p offset
+     */
+    void submit(Group *group, uint64_t offset, size_t padded);
+    void flush_loop();
+    void complete_loop();
+    void preallocate_loop();
+
+    std::string filename_;
+    WalOptions options_;
+    size_t capacity_;
+    io_context_t ctx_;
+    LogTail recovered_;
+    // drawn on open, see GroupHeader
+    uint32_t epoch_{0};
+    // the epoch of the last group written, only used by the flusher
+    uint32_t parent_{0};
+
+    std::mutex mutex_;
+    // wakes the flusher
+    std::condition_variable flush_cv_;
+    // wakes the appenders waiting for a free group
+    std::condition_variable free_cv_;
+    std::vector<std::unique_ptr<Group>> groups_;
+    std::vector<Group *> free_;
+    Group *open_{nullptr};
+    // full groups, waiting for the flusher
+    std::deque<Group *> sealed_;
+    // written groups, in Lsn order
+    std::deque<Group *> inflight_;
+    bool flush_requested_{false};
+    bool stop_{false};
+    // set by the first failed write: no later record is durable
+    bool failed_{false};
+    Lsn next_lsn_{1};
+    // in the last segment
+    uint64_t offset_{0};
+    WalStats stats_;
+
+    // in the log, oldest first: the last one is written
+    std::deque<Segment> segments_;
+    // preallocated, in index order
+    std::deque<Segment> ready_;
+    // dropped by Truncate(), to recycle or delete
+    std::vector<Segment> retired_;
+    uint64_t next_index_{0};
+    // wakes the preallocator
+    std::condition_variable preallocate_cv_;
+    bool preallocate_stop_{false};
+    // only warn once
+    bool fallocate_failed_{false};
+
+    std::atomic<Lsn> durable_lsn_{0};
+    std::thread flusher_;
+    std::thread completer_;
+    std::thread preallocator_;
+};
+}  // namespace disk
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,188 @@
+/**
+ * @file HDR-style log-linear histograms for latency recording
+ *
+ * Values are bucketed by their magnitude (power of two) and, within a
+ * magnitude, by their top kSubBucketBits bits. The relative error of any
+ * reported value is thus bounded by 2^-kSubBucketBits (~3%), for the whole
+ * uint64_t range, in a fixed amount of memory.
+ */
+#ifndef HISTOGRAM_H_
+#define HISTOGRAM_H_
+
+#include <inttypes.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+namespace zeno
+{
+namespace hist
+{
+constexpr unsigned kSubBucketBits = 5;
+constexpr uint64_t kSubBucketNr = 1ull << kSubBucketBits;
+constexpr size_t kBucketNr = (65 - kSubBucketBits) * kSubBucketNr;
+
+inline size_t bucket_of(uint64_t value)
+{
+    if (value < kSubBucketNr)
+    {
+        return value;
+    }
+    unsigned msb = 63 - __builtin_clzll(value);
+    unsigned shift = msb - kSubBucketBits;
+    return (shift + 1) * kSubBucketNr + ((value >> shift) - kSubBucketNr);
+}
+
+/**
+ * @brief the largest value falling into bucket @p index
+ */
+inline uint64_t bucket_upper(size_t index)
+{
+    if (index < kSubBucketNr)
+    {
+        return index;
+    }
+    unsigned shift = index / kSubBucketNr - 1;
+    uint64_t mantissa = kSubBucketNr + index % kSubBucketNr;
+    return ((mantissa + 1) << shift) - 1;
+}
+}  // namespace hist
+
+/**
+ * @brief a single-threaded histogram
+ */
+class Histogram
+{
+public:
+    Histogram() : buckets_(hist::kBucketNr, 0)
+    {
+    }
+
+    void record(uint64_t value, uint64_t count = 1)
+    {
+        buckets_[hist::bucket_of(value)] += count;
+        count_ += count;
+        if (value > max_)
+        {
+            max_ = value;
+        }
+    }
+
+    void merge(const Histogram &rhs)
+    {
+        for (size_t i = 0; i < hist::kBucketNr; ++i)
+        {
+            buckets_[i] += rhs.buckets_[i];
+        }
+        count_ += rhs.count_;
+        if (rhs.max_ > max_)
+        {
+            max_ = rhs.max_;
+        }
+    }
+
+    uint64_t count() const
+    {
+        return count_;
+    }
+    uint64_t max() const
+    {
+        return max_;
+    }
+
+    /**
+     * @brief the value below which @p p percent of the records fall
+     *
+     * @param p in [0, 100]
+     */
+    uint64_t percentile(double p) const
+    {
+        if (count_ == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(p / 100 * count_ + 0.5);
+        if (rank == 0)
+        {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for (size_t i = 0; i < hist::kBucketNr; ++i)
+        {
+            seen += buckets_[i];
+            if (seen >= rank)
+            {
+                uint64_t upper = hist::bucket_upper(i);
+                return upper < max_ ? upper : max_;
+            }
+        }
+        return max_;
+    }
+
+    void reset()
+    {
+        std::fill(buckets_.begin(), buckets_.end(), 0);
+        count_ = 0;
+        max_ = 0;
+    }
+
+private:
+    friend class ConcurrentHistogram;
+
+    std::vector<uint64_t> buckets_;
+    uint64_t count_{0};
+    uint64_t max_{0};
+};
+
+/**
+ * @brief a histogram recorded by one thread and drained by another
+ *
+ * The owner calls record(); a reporting thread periodically calls
+ * drain_into() to move everything recorded so far into a Histogram.
+ * Nothing is lost or counted twice across a drain.
+ */
+class ConcurrentHistogram
+{
+public:
+    ConcurrentHistogram() : buckets_(hist::kBucketNr)
+    {
+        for (auto &b : buckets_)
+        {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(uint64_t value)
+    {
+        buckets_[hist::bucket_of(value)].fetch_add(1,
+                                                   std::memory_order_relaxed);
+        uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max &&
+               !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void drain_into(Histogram &out)
+    {
+        for (size_t i = 0; i < hist::kBucketNr; ++i)
+        {
+            uint64_t nr = buckets_[i].exchange(0, std::memory_order_relaxed);
+            out.buckets_[i] += nr;
+            out.count_ += nr;
+        }
+        uint64_t max = max_.exchange(0, std::memory_order_relaxed);
+        if (max > out.max_)
+        {
+            out.max_ = max;
+        }
+    }
+
+private:
+    std::vector<std::atomic<uint64_t>> buckets_;
+    std::atomic<uint64_t> max_{0};
+};
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef NET_ADDRESS_H_
+#define NET_ADDRESS_H_
+
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <boost/asio/ip/udp.hpp>
+
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief a trivially copyable peer address, IPv4 or IPv6
+ *
+ * udp::endpoint is not trivially copyable, which the lock-free readers of
+ * ClientTable rely on. ClientAddress holds the same sockaddr and converts
+ * back and forth.
+ */
+struct ClientAddress
+{
+    union
+    {
+        sockaddr addr;
+        sockaddr_in v4;
+        sockaddr_in6 v6;
+    };
+    socklen_t len;
+
+    static ClientAddress from(const sockaddr *addr, socklen_t len)
+    {
+        ClientAddress ret;
+        dcheck(len <= sizeof(sockaddr_in6), "address too long: %u", len);
+        memset(&ret, 0, sizeof(ret));
+        memcpy(&ret.addr, addr, len);
+        ret.len = len;
+        return ret;
+    }
+    static ClientAddress from(const boost::asio::ip::udp::endpoint &endpoint)
+    {
+        return from(endpoint.data(), endpoint.size());
+    }
+
+    boost::asio::ip::udp::endpoint endpoint() const
+    {
+        boost::asio::ip::udp::endpoint ret;
+        memcpy(ret.data(), &addr, len);
+        ret.resize(len);
+        return ret;
+    }
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
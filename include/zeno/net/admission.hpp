@@ -0,0 +1,217 @@
+#ifndef NET_ADMISSION_H_
+#define NET_ADMISSION_H_
+
+#include <inttypes.h>
+
+#include <chrono>
+#include <unordered_map>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/header.hpp"
+#include "zeno/net/options.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief what an Admission decided since it was built
+ */
+struct AdmissionStats
+{
+    uint64_t admitted{0};
+    // shed because max_inflight requests were in flight
+    uint64_t shed_full{0};
+    // shed because the client was above its fair share
+    uint64_t shed_client{0};
+    // shed because the client was out of tokens
+    uint64_t shed_bucket{0};
+
+    uint64_t shed() const
+    {
+        return shed_full + shed_client + shed_bucket;
+    }
+};
+
+/**
+ * @brief bound the requests a server has in flight, shedding the excess
+ * before it costs anything but the receive
+ *
+ * admit() is called for every request before it is queued, and release()
+ * once it is answered. No more than max_inflight requests are ever
+ * admitted at once, whatever the policy; see ShedPolicy for who is shed
+ * first. Past saturation the queue stays short, so the admitted requests
+ * keep their latency and goodput stays flat instead of collapsing.
+ *
+ * The per-client state is only kept while a client is active, and forgotten
+ * by sweep() after a second of silence.
+ *
+ * Not thread-safe: call it from one thread or one strand.
+ */
+class Admission
+{
+public:
+    explicit Admission(const AdmissionOptions &options) : options_(options)
+    {
+    }
+
+    bool enabled() const
+    {
+        return options_.max_inflight != 0;
+    }
+    size_t inflight() const
+    {
+        return inflight_;
+    }
+    const AdmissionStats &stats() const
+    {
+        return stats_;
+    }
+
+    /**
+     * @return whether the request of @p id may be queued. If so, it must be
+     * released once answered.
+     */
+    bool admit(ClientId id)
+    {
+        if (inflight_ >= options_.max_inflight)
+        {
+            stats_.shed_full++;
+            return false;
+        }
+        ClientState &client = clients_[id];
+        client.touched = true;
+        if (options_.policy == ShedPolicy::DropByClient)
+        {
+            size_t active = active_ + (client.inflight == 0 ? 1 : 0);
+            size_t share = options_.max_inflight / active;
+            if (client.inflight >= (share ? share : 1))
+            {
+                stats_.shed_client++;
+                return false;
+            }
+        }
+        else if (options_.policy == ShedPolicy::TokenBucket)
+        {
+            refill(client, now_ns());
+            if (client.tokens < 1)
+            {
+                stats_.shed_bucket++;
+                return false;
+            }
+            client.tokens -= 1;
+        }
+        if (client.inflight++ == 0)
+        {
+            active_++;
+        }
+        inflight_++;
+        stats_.admitted++;
+        return true;
+    }
+
+    void release(ClientId id)
+    {
+        auto it = clients_.find(id);
+        dcheck(it != clients_.end() && it->second.inflight > 0,
+               "release a request of client %" PRIu64 " never admitted",
+               id);
+        if (--it->second.inflight == 0)
+        {
+            active_--;
+        }
+        inflight_--;
+    }
+
+    /**
+     * @brief forget the clients with nothing in flight, silent since the
+     * last sweep and, for TokenBucket, with a full bucket again
+     */
+    void sweep()
+    {
+        uint64_t now = now_ns();
+        for (auto it = clients_.begin(); it != clients_.end();)
+        {
+            ClientState &client = it->second;
+            bool idle = client.inflight == 0 && !client.touched;
+            if (idle && options_.policy == ShedPolicy::TokenBucket)
+            {
+                refill(client, now);
+                idle = client.tokens >= options_.client_burst;
+            }
+            client.touched = false;
+            it = idle ? clients_.erase(it) : std::next(it);
+        }
+    }
+
+    /**
+     * @brief log the decisions since the last report, if any request came
+     */
+    void report()
+    {
+        AdmissionStats diff;
+        diff.admitted = stats_.admitted - reported_.admitted;
+        diff.shed_full = stats_.shed_full - reported_.shed_full;
+        diff.shed_client = stats_.shed_client - reported_.shed_client;
+        diff.shed_bucket = stats_.shed_bucket - reported_.shed_bucket;
+        if (diff.admitted != 0 || diff.shed() != 0)
+        {
+            info("Admission: %" PRIu64 " admitted, %" PRIu64
+                 " shed (%" PRIu64 " full, %" PRIu64 " over share, %" PRIu64
+                 " out of tokens), %lu in flight, %lu clients",
+                 diff.admitted,
+                 diff.shed(),
+                 diff.shed_full,
+                 diff.shed_client,
+                 diff.shed_bucket,
+                 inflight_,
+                 clients_.size());
+        }
+        reported_ = stats_;
+    }
+
+private:
+    struct ClientState
+    {
+        size_t inflight{0};
+        double tokens{-1};
+        uint64_t last_ns{0};
+        bool touched{false};
+    };
+
+    static uint64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void refill(ClientState &client, uint64_t now)
+    {
+        if (client.tokens < 0)
+        {
+            client.tokens = options_.client_burst;
+        }
+        else
+        {
+            client.tokens += (now - client.last_ns) / 1e9 * options_.client_rate;
+            if (client.tokens > options_.client_burst)
+            {
+                client.tokens = options_.client_burst;
+            }
+        }
+        client.last_ns = now;
+    }
+
+    AdmissionOptions options_;
+    std::unordered_map<ClientId, ClientState> clients_;
+    size_t inflight_{0};
+    // clients with at least one request in flight
+    size_t active_{0};
+    AdmissionStats stats_;
+    AdmissionStats reported_;
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,539 @@
+#ifndef NET_ASYNC_CLIENT_H_
+#define NET_ASYNC_CLIENT_H_
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <boost/asio.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <chrono>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/header.hpp"
+#include "zeno/net/mmsg.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/timing-wheel.hpp"
+
+namespace zeno
+{
+namespace net
+{
+using boost::asio::ip::udp;
+
+enum class ReplyStatus
+{
+    Ok,
+    // no reply after every retry
+    Timeout,
+    // shed by the server, which answered with an Overload packet
+    Overloaded,
+};
+
+/**
+ * @brief knobs of an AsyncClient
+ */
+struct AsyncClientOptions
+{
+    /**
+     * max number of requests awaiting a reply. send() fails beyond.
+     */
+    size_t max_inflight{4096};
+    /**
+     * milliseconds without a reply before a request is sent again.
+     */
+    uint64_t timeout_ms{100};
+    /**
+     * how many times a request is sent again before it times out.
+     */
+    unsigned retries{2};
+    /**
+     * max number of datagrams per recvmmsg and per sendmmsg.
+     */
+    size_t batch_size{64};
+    /**
+     * seal every request with a CRC32C, and drop the replies whose checksum
+     * does not match, as if lost.
+     */
+    bool checksum{false};
+};
+
+/**
+ * @brief what an AsyncClient did since it was built
+ */
+struct AsyncClientStats
+{
+    uint64_t requests{0};
+    uint64_t replies{0};
+    uint64_t retries{0};
+    uint64_t timeouts{0};
+    uint64_t overloads{0};
+    // replies to a request already answered or given up
+    uint64_t stale{0};
+    // replies dropped for a bad checksum
+    uint64_t corrupt{0};
+    uint64_t send_syscalls{0};
+    uint64_t recv_syscalls{0};
+};
+
+/**
+ * @brief many concurrent requests to one UDP server, driven by one thread
+ *
+ * send() never blocks: it copies the request into a free slot, arms its
+ * timeout and queues it. All the requests issued in one round of the
+ * io_context leave together with sendmmsg, and replies are drained with
+ * recvmmsg, so a single thread keeps thousands of requests in flight.
+ *
+ * Every request is a PacketHeader, then a RequestId, then the body. The
+ * server must send the RequestId back at the start of the response body,
+ * as an echo does; the reply is then matched to its slot in O(1), and
+ * @p OnReply is called as on_reply(tag, ReplyStatus::Ok, body, length) with
+ * the body after the RequestId. A request without a reply is sent again
+ * after timeout_ms, up to retries times, and then reported with
+ * ReplyStatus::Timeout. An Overload answer is reported at once with
+ * ReplyStatus::Overloaded and not retried: backing off is up to the caller.
+ *
+ * Timeouts live in a TimingWheel of 1 ms ticks, driven by a single asio
+ * timer armed only while requests are in flight.
+ *
+ * on_reply may call send(). Everything runs on the io_context, which must
+ * be run by one thread only.
+ */
+template <typename OnReply>
+class AsyncClient
+{
+public:
+    // the slot index in the low half, its generation in the high half
+    using RequestId = uint64_t;
+    static constexpr size_t kMaxPacket = 1024;
+    static constexpr size_t kRequestOverhead =
+        sizeof(PacketHeader) + sizeof(RequestId);
+    static constexpr uint64_t kTickMs = 1;
+
+    AsyncClient(boost::asio::io_context &io_context,
+                const udp::endpoint &server,
+                ClientId client_id,
+                const AsyncClientOptions &options = AsyncClientOptions(),
+                OnReply on_reply = OnReply())
+        : socket_(io_context),
+          timer_(io_context),
+          client_id_(client_id),
+          options_(options),
+          on_reply_(on_reply),
+          slots_(options.max_inflight),
+          packets_(options.max_inflight * kMaxPacket),
+          origin_(std::chrono::steady_clock::now()),
+          recv_batch_(options.batch_size, kMaxPacket),
+          send_msgs_(options.batch_size),
+          send_iovecs_(options.batch_size),
+          send_positions_(options.batch_size)
+    {
+        check(options.max_inflight > 0 && options.max_inflight <= kIndexMask,
+              "max_inflight should be in [1, %" PRIu64 "]",
+              kIndexMask);
+        socket_.open(udp::v4());
+        socket_.connect(server);
+        socket_.non_blocking(true);
+
+        free_.reserve(options.max_inflight);
+        for (size_t i = options.max_inflight; i > 0; --i)
+        {
+            free_.push_back(i - 1);
+        }
+        do_wait();
+    }
+    AsyncClient(const AsyncClient &) = delete;
+    AsyncClient &operator=(const AsyncClient &) = delete;
+
+    /**
+     * @brief issue a request carrying @p body, reported to on_reply with
+     * @p tag
+     *
+     * @return false if max_inflight requests are already in flight, or if
+     * the body does not fit in a datagram
+     */
+    bool send(const char *body,
+              size_t length,
+              uint64_t tag,
+              PacketType type = PacketType::Normal)
+    {
+        if (free_.empty() || length > kMaxPacket - kRequestOverhead)
+        {
+            return false;
+        }
+        uint32_t index = free_.back();
+        free_.pop_back();
+        Slot &slot = slots_[index];
+        slot.generation++;
+        slot.id = ((RequestId) slot.generation << 32) | index;
+        slot.tag = tag;
+        slot.length = kRequestOverhead + length;
+        slot.attempts = 0;
+        slot.live = true;
+
+        PacketHeader header;
+        header.packet_length = slot.length;
+        header.checksum = 0;
+        header.client_id = client_id_;
+        header.packet_type = type;
+        char *packet = packet_of(index);
+        memcpy(packet, &header, sizeof(header));
+        memcpy(packet + sizeof(header), &slot.id, sizeof(slot.id));
+        memcpy(packet + kRequestOverhead, body, length);
+        if (options_.checksum)
+        {
+            SealPacket(packet, slot.length);
+        }
+
+        if (wheel_.size() == 0)
+        {
+            // nothing to fire on the way: skip the ticks spent idle.
+            wheel_.reset(current_tick());
+        }
+        arm();
+        slot.timer = wheel_.schedule(deadline(), slot.id);
+        enqueue(slot.id);
+        stats_.requests++;
+        return true;
+    }
+
+    size_t inflight() const
+    {
+        return slots_.size() - free_.size();
+    }
+    const AsyncClientStats &stats() const
+    {
+        return stats_;
+    }
+    OnReply &on_reply()
+    {
+        return on_reply_;
+    }
+
+private:
+    static constexpr uint64_t kIndexMask = 0xffffffffull;
+
+    struct Slot
+    {
+        RequestId id{0};
+        uint64_t tag{0};
+        size_t length{0};
+        TimingWheel::TimerId timer{TimingWheel::kInvalid};
+        uint32_t generation{0};
+        unsigned attempts{0};
+        bool live{false};
+    };
+
+    char *packet_of(uint32_t index)
+    {
+        return packets_.data() + index * kMaxPacket;
+    }
+
+    /**
+     * @brief the slot of @p id, or nullptr if that request is over
+     */
+    Slot *find(RequestId id)
+    {
+        uint64_t index = id & kIndexMask;
+        if (index >= slots_.size())
+        {
+            return nullptr;
+        }
+        Slot &slot = slots_[index];
+        return slot.live && slot.id == id ? &slot : nullptr;
+    }
+
+    void release(Slot &slot)
+    {
+        slot.live = false;
+        free_.push_back(slot.id & kIndexMask);
+    }
+
+    /**
+     * @brief the kTickMs ticks since the client was built
+     */
+    uint64_t current_tick() const
+    {
+        auto elapsed = std::chrono::steady_clock::now() - origin_;
+        return std::chrono::duration_cast<std::chrono::milliseconds>(elapsed)
+                   .count() /
+               kTickMs;
+    }
+    uint64_t deadline() const
+    {
+        return current_tick() + (options_.timeout_ms + kTickMs - 1) / kTickMs;
+    }
+
+    /**
+     * @brief queue @p id for the next flush(), posted once per round
+     */
+    void enqueue(RequestId id)
+    {
+        send_queue_.push_back(id);
+        if (!flush_posted_)
+        {
+            flush_posted_ = true;
+            boost::asio::post(socket_.get_executor(), [this]() {
+                flush_posted_ = false;
+                flush();
+            });
+        }
+    }
+
+    /**
+     * @brief sendmmsg the queued requests until done or the socket is full,
+     * then wait for it to drain
+     *
+     * Requests answered or given up while queued are skipped. A request
+     * the kernel refused is not retried here: its timeout will.
+     */
+    void flush()
+    {
+        if (writing_)
+        {
+            return;
+        }
+        int fd = socket_.native_handle();
+        while (head_ < send_queue_.size())
+        {
+            size_t nr = 0;
+            size_t end = head_;
+            while (end < send_queue_.size() && nr < send_msgs_.size())
+            {
+                Slot *slot = find(send_queue_[end]);
+                if (slot != nullptr)
+                {
+                    uint32_t index = slot->id & kIndexMask;
+                    send_iovecs_[nr].iov_base = packet_of(index);
+                    send_iovecs_[nr].iov_len = slot->length;
+                    memset(&send_msgs_[nr], 0, sizeof(mmsghdr));
+                    send_msgs_[nr].msg_hdr.msg_iov = &send_iovecs_[nr];
+                    send_msgs_[nr].msg_hdr.msg_iovlen = 1;
+                    send_positions_[nr] = end;
+                    nr++;
+                }
+                end++;
+            }
+            if (nr == 0)
+            {
+                head_ = end;
+                continue;
+            }
+            int ret = ::sendmmsg(fd, send_msgs_.data(), nr, MSG_DONTWAIT);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    wait_writable();
+                    return;
+                }
+                dinfo("sendmmsg failed: %s", strerror(errno));
+                head_ = end;
+                continue;
+            }
+            stats_.send_syscalls++;
+            head_ = (size_t) ret < nr ? send_positions_[ret] : end;
+        }
+        send_queue_.clear();
+        head_ = 0;
+    }
+
+    void wait_writable()
+    {
+        writing_ = true;
+        socket_.async_wait(udp::socket::wait_write,
+                           [this](boost::system::error_code ec) {
+                               writing_ = false;
+                               if (!ec)
+                               {
+                                   flush();
+                               }
+                           });
+    }
+
+    void do_wait()
+    {
+        socket_.async_wait(udp::socket::wait_read,
+                           [this](boost::system::error_code ec) {
+                               if (ec)
+                               {
+                                   error_if(ec != boost::asio::error::
+                                                      operation_aborted,
+                                            "wait_read get errno: %d",
+                                            ec.value());
+                                   return;
+                               }
+                               drain();
+                               flush();
+                               do_wait();
+                           });
+    }
+
+    /**
+     * @brief recvmmsg until EAGAIN, completing the requests replied to
+     */
+    void drain()
+    {
+        int fd = socket_.native_handle();
+        while (true)
+        {
+            int nr = recv_batch_.recv(fd);
+            if (nr < 0)
+            {
+                if (errno == ECONNREFUSED)
+                {
+                    // a queued ICMP error: the server is not up (yet), and
+                    // the timeouts retry.
+                    continue;
+                }
+                error_if(errno != EAGAIN && errno != EWOULDBLOCK,
+                         "recvmmsg failed: %s",
+                         strerror(errno));
+                return;
+            }
+            stats_.recv_syscalls++;
+            for (int i = 0; i < nr; ++i)
+            {
+                on_datagram(recv_batch_.data(i), recv_batch_.length(i));
+            }
+            if ((size_t) nr < recv_batch_.capacity())
+            {
+                return;
+            }
+        }
+    }
+
+    void on_datagram(const char *data, size_t length)
+    {
+        if (unlikely(length < kRequestOverhead))
+        {
+            return;
+        }
+        if (options_.checksum && !VerifyPacket(data, length))
+        {
+            stats_.corrupt++;
+            return;
+        }
+        RequestId id;
+        memcpy(&id, data + sizeof(PacketHeader), sizeof(id));
+        Slot *slot = find(id);
+        if (slot == nullptr)
+        {
+            stats_.stale++;
+            return;
+        }
+        wheel_.cancel(slot->timer);
+        release(*slot);
+        if (ParsePacketType(data) == PacketType::Overload)
+        {
+            stats_.overloads++;
+            on_reply_(slot->tag, ReplyStatus::Overloaded, nullptr, 0);
+            return;
+        }
+        stats_.replies++;
+        on_reply_(slot->tag,
+                  ReplyStatus::Ok,
+                  data + kRequestOverhead,
+                  length - kRequestOverhead);
+    }
+
+    /**
+     * @brief tick the wheel every kTickMs while requests are in flight
+     *
+     * The wheel follows the ticks elapsed since origin_, so that a late
+     * timer only delays the next tick and the wheel keeps real time. An
+     * idle client costs nothing: the wheel skips the idle ticks at once.
+     */
+    void arm()
+    {
+        if (armed_)
+        {
+            return;
+        }
+        armed_ = true;
+        timer_.expires_from_now(boost::posix_time::milliseconds(kTickMs));
+        timer_.async_wait([this](boost::system::error_code ec) {
+            armed_ = false;
+            if (!ec)
+            {
+                tick();
+            }
+        });
+    }
+
+    void tick()
+    {
+        wheel_.advance(current_tick(),
+                       [this](TimingWheel::TimerId, uint64_t id) {
+                           expire(id);
+                       });
+        flush();
+        if (wheel_.size() != 0)
+        {
+            arm();
+        }
+    }
+
+    void expire(RequestId id)
+    {
+        Slot *slot = find(id);
+        if (slot == nullptr)
+        {
+            return;
+        }
+        if (slot->attempts < options_.retries)
+        {
+            slot->attempts++;
+            slot->timer = wheel_.schedule(deadline(), id);
+            enqueue(id);
+            stats_.retries++;
+            return;
+        }
+        release(*slot);
+        stats_.timeouts++;
+        on_reply_(slot->tag, ReplyStatus::Timeout, nullptr, 0);
+    }
+
+    udp::socket socket_;
+    boost::asio::deadline_timer timer_;
+    ClientId client_id_;
+    AsyncClientOptions options_;
+    OnReply on_reply_;
+
+    std::vector<Slot> slots_;
+    // the packet of slot i at i * kMaxPacket, kept for retries
+    std::vector<char> packets_;
+    std::vector<uint32_t> free_;
+    TimingWheel wheel_;
+    // tick 0 of the wheel
+    std::chrono::steady_clock::time_point origin_;
+    bool armed_{false};
+
+    MsgBatch recv_batch_;
+    std::vector<RequestId> send_queue_;
+    // send_queue_[head_, ) is still to be sent
+    size_t head_{0};
+    std::vector<mmsghdr> send_msgs_;
+    std::vector<iovec> send_iovecs_;
+    // the position in send_queue_ of each message of the last sendmmsg
+    std::vector<size_t> send_positions_;
+    bool flush_posted_{false};
+    bool writing_{false};
+
+    AsyncClientStats stats_;
+};
+// ODR-used through boost::posix_time before C++17.
+template <typename OnReply>
+constexpr uint64_t AsyncClient<OnReply>::kTickMs;
+}  // namespace net
+}  // namespace zeno
+
+#endif
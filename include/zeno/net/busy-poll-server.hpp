@@ -0,0 +1,290 @@
+#ifndef NET_BUSY_POLL_SERVER_H_
+#define NET_BUSY_POLL_SERVER_H_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "zeno/cpu.hpp"
+#include "zeno/crc32c.hpp"
+#include "zeno/debug.hpp"
+#include "zeno/net/client-registry.hpp"
+#include "zeno/net/mmsg.hpp"
+#include "zeno/net/options.hpp"
+#include "zeno/net/parser.hpp"
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief the echo server of zeno::net::server, spinning on a non-blocking
+ * socket instead of sleeping in epoll
+ *
+ * run() loops on recvmmsg(MSG_DONTWAIT) and answers every batch with
+ * sendmmsg, so a datagram is picked up as soon as it reaches the socket,
+ * without a reactor wakeup or a context switch. The price is one CPU burnt
+ * at 100%, which is why the thread is pinned to options.cpu if given.
+ *
+ * With options.busy_poll_us, the socket also gets SO_BUSY_POLL (and
+ * SO_PREFER_BUSY_POLL if asked), letting each empty receive poll the NIC
+ * queue for that long instead of waiting for its interrupt.
+ *
+ * With options.verify_checksum, the datagrams of a batch are verified at
+ * once with VerifyPackets(), and those failing are neither registered nor
+ * echoed.
+ *
+ * run() blocks the calling thread; one BusyPollServer should be driven by one
+ * thread only.
+ */
+class BusyPollServer
+{
+public:
+    enum
+    {
+        max_length = 1024
+    };
+    // the heartbeat clock is only read every kClockEvery polls.
+    static constexpr uint64_t kClockEvery = 64;
+
+    BusyPollServer(short port, const ServerOptions &options = ServerOptions())
+        : cpu_(options.cpu),
+          batch_(options.batch_size, max_length),
+          clients_(options.idle_timeout),
+          verify_checksum_(options.verify_checksum),
+          verify_packets_(options.batch_size),
+          verify_lengths_(options.batch_size),
+          verified_(new bool[options.batch_size])
+    {
+        fd_ = ::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        check(fd_ >= 0, "failed to create socket: %s", strerror(errno));
+        if (options.reuse_port)
+        {
+            int one = 1;
+            check(setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) ==
+                      0,
+                  "failed to set SO_REUSEPORT: %s",
+                  strerror(errno));
+        }
+        if (options.busy_poll_us > 0)
+        {
+            int usec = options.busy_poll_us;
+            warn_if(setsockopt(fd_, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) !=
+                        0,
+                    "failed to set SO_BUSY_POLL to %d us: %s",
+                    usec,
+                    strerror(errno));
+        }
+        if (options.prefer_busy_poll)
+        {
+            int one = 1;
+            warn_if(setsockopt(fd_,
+                               SOL_SOCKET,
+                               SO_PREFER_BUSY_POLL,
+                               &one,
+                               sizeof(one)) != 0,
+                    "failed to set SO_PREFER_BUSY_POLL: %s",
+                    strerror(errno));
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        check(bind(fd_, (sockaddr *) &addr, sizeof(addr)) == 0,
+              "failed to bind port %d: %s",
+              port,
+              strerror(errno));
+
+        info("Server (busy poll) is listening on 0.0.0.0:%d", port);
+        info_if(verify_checksum_,
+                "CRC32C checksums verified, %s",
+                Crc32cAccelerated() ? "with SSE4.2" : "in software");
+    }
+    ~BusyPollServer()
+    {
+        close(fd_);
+    }
+    BusyPollServer(const BusyPollServer &) = delete;
+    BusyPollServer &operator=(const BusyPollServer &) = delete;
+
+    void run()
+    {
+        if (cpu_ >= 0 && PinThread(cpu_))
+        {
+            info("Busy poll thread pinned to CPU %d", cpu_);
+        }
+        auto deadline = Clock::now() + std::chrono::seconds(1);
+        uint64_t polls = 0;
+        while (!stop_.load(std::memory_order_relaxed))
+        {
+            if (++polls % kClockEvery == 0 && Clock::now() >= deadline)
+            {
+                dinfo("Heartbeat one second.");
+                clients_.tick();
+                clients_.report();
+                report();
+                deadline = Clock::now() + std::chrono::seconds(1);
+            }
+            poll();
+        }
+    }
+
+    /**
+     * @brief ask run() to return. It notices within a few polls.
+     */
+    void stop()
+    {
+        stop_ = true;
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void poll()
+    {
+        polls_++;
+        int nr = batch_.recv(fd_);
+        if (nr <= 0)
+        {
+            error_if(nr < 0 && errno != EAGAIN && errno != EWOULDBLOCK,
+                     "recvmmsg failed: %s",
+                     strerror(errno));
+            idle_polls_++;
+            CpuRelax();
+            return;
+        }
+        recv_datagrams_ += nr;
+        if (verify_checksum_)
+        {
+            verify_batch(nr);
+        }
+
+        for (int i = 0; i < nr; ++i)
+        {
+            if (unlikely(batch_.length(i) < sizeof(PacketHeader)))
+            {
+                continue;
+            }
+            clients_.on_packet(ParseClientId(batch_.data(i)),
+                               ParsePacketType(batch_.data(i)),
+                               batch_.name(i),
+                               batch_.namelen(i));
+        }
+
+        // echo the runs of slots left non-empty.
+        size_t first = 0;
+        while (first < (size_t) nr)
+        {
+            if (batch_.length(first) == 0)
+            {
+                first++;
+                continue;
+            }
+            size_t end = first;
+            while (end < (size_t) nr && batch_.length(end) != 0)
+            {
+                end++;
+            }
+            while (first < end)
+            {
+                int ret = batch_.send(fd_, first, end - first);
+                if (ret < 0)
+                {
+                    error_if(errno != EAGAIN && errno != EWOULDBLOCK,
+                             "sendmmsg failed: %s",
+                             strerror(errno));
+                    send_dropped_ += end - first;
+                    break;
+                }
+                first += ret;
+            }
+            first = end;
+        }
+    }
+
+    /**
+     * @brief verify the checksums of the first @p nr datagrams at once,
+     * emptying the slots of those failing
+     */
+    void verify_batch(int nr)
+    {
+        for (int i = 0; i < nr; ++i)
+        {
+            verify_packets_[i] = batch_.data(i);
+            verify_lengths_[i] = batch_.length(i);
+        }
+        if (VerifyPackets(verify_packets_.data(),
+                          verify_lengths_.data(),
+                          nr,
+                          verified_.get()) == 0)
+        {
+            return;
+        }
+        for (int i = 0; i < nr; ++i)
+        {
+            if (!verified_[i])
+            {
+                batch_.set_length(i, 0);
+                corrupt_++;
+            }
+        }
+    }
+
+    void report()
+    {
+        if (recv_datagrams_ != 0)
+        {
+            info("Busy poll: %" PRIu64 " datagrams in %" PRIu64
+                 " polls, %" PRIu64 " idle (%.2lf%%), %" PRIu64
+                 " replies dropped",
+                 recv_datagrams_,
+                 polls_,
+                 idle_polls_,
+                 100.0 * idle_polls_ / polls_,
+                 send_dropped_);
+        }
+        warn_if(corrupt_ != 0,
+                "Dropped %" PRIu64 " datagrams with a bad checksum",
+                corrupt_);
+        polls_ = 0;
+        idle_polls_ = 0;
+        recv_datagrams_ = 0;
+        send_dropped_ = 0;
+        corrupt_ = 0;
+    }
+
+    int fd_{-1};
+    int cpu_;
+    MsgBatch batch_;
+    ClientRegistry clients_;
+
+    std::atomic<bool> stop_{false};
+
+    uint64_t polls_{0};
+    uint64_t idle_polls_{0};
+    uint64_t recv_datagrams_{0};
+    uint64_t send_dropped_{0};
+
+    bool verify_checksum_;
+    // the datagrams of the batch being handled, and whether each passed
+    std::vector<const char *> verify_packets_;
+    std::vector<size_t> verify_lengths_;
+    std::unique_ptr<bool[]> verified_;
+    uint64_t corrupt_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
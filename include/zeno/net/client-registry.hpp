@@ -0,0 +1,154 @@
+#ifndef NET_CLIENT_REGISTRY_H_
+#define NET_CLIENT_REGISTRY_H_
+
+#include <inttypes.h>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/address.hpp"
+#include "zeno/net/client-table.hpp"
+#include "zeno/net/header.hpp"
+#include "zeno/timing-wheel.hpp"
+
+namespace zeno
+{
+namespace net
+{
+struct ClientEntry
+{
+    ClientAddress address;
+    TimingWheel::TimerId timer;
+};
+
+/**
+ * @brief the session lifecycle of the clients of one server
+ *
+ * - Join registers the client, or refreshes its address.
+ * - Leave forgets it.
+ * - Any other packet from an unknown client is an implicit Join, and from a
+ *   known one marks it as alive.
+ * - A client silent for idle_timeout ticks is evicted.
+ *
+ * Every client owns one timer in a TimingWheel. A packet only postpones
+ * that timer, and the wheel re-checks the deadline when the slot comes
+ * due, so the per-packet cost is a table lookup and a store. There is no
+ * per-client asio timer. The table and the wheel keep the room of the most
+ * clients ever live at once, however many come and go.
+ *
+ * The table can be read from any thread, but on_packet() and tick() must
+ * be called by the owner thread only.
+ */
+class ClientRegistry
+{
+public:
+    /**
+     * @param idle_timeout ticks of silence before eviction. 0 keeps clients
+     * until they leave.
+     */
+    explicit ClientRegistry(uint64_t idle_timeout) : idle_timeout_(idle_timeout)
+    {
+    }
+
+    void on_packet(ClientId id,
+                   PacketType type,
+                   const sockaddr *name,
+                   socklen_t namelen)
+    {
+        if (type == PacketType::Leave)
+        {
+            leave(id);
+            return;
+        }
+        ClientEntry entry;
+        if (likely(table_.find(id, &entry)))
+        {
+            if (entry.timer != TimingWheel::kInvalid)
+            {
+                wheel_.postpone(entry.timer, wheel_.now() + idle_timeout_);
+            }
+            if (type == PacketType::Join)
+            {
+                entry.address = ClientAddress::from(name, namelen);
+                table_.upsert(id, entry);
+            }
+            return;
+        }
+        entry.address = ClientAddress::from(name, namelen);
+        entry.timer = idle_timeout_ ? wheel_.schedule(
+                                          wheel_.now() + idle_timeout_, id)
+                                    : TimingWheel::kInvalid;
+        table_.upsert(id, entry);
+        joined_++;
+        dinfo("Add (%" PRIu64 ", %s:%d) into known clients",
+              id,
+              entry.address.endpoint().address().to_string().c_str(),
+              entry.address.endpoint().port());
+    }
+
+    void leave(ClientId id)
+    {
+        ClientEntry entry;
+        if (!table_.find(id, &entry))
+        {
+            return;
+        }
+        if (entry.timer != TimingWheel::kInvalid)
+        {
+            wheel_.cancel(entry.timer);
+        }
+        table_.erase(id);
+        left_++;
+        dinfo("Client %" PRIu64 " leaves", id);
+    }
+
+    /**
+     * @brief advance the clock by one tick, evicting the idle clients
+     */
+    void tick()
+    {
+        wheel_.advance(wheel_.now() + 1,
+                       [this](TimingWheel::TimerId, uint64_t id) {
+                           table_.erase(id);
+                           evicted_++;
+                           dinfo("Evict idle client %" PRIu64, id);
+                       });
+    }
+
+    const ClientTable<ClientEntry> &table() const
+    {
+        return table_;
+    }
+    size_t size() const
+    {
+        return table_.size();
+    }
+
+    /**
+     * @brief log the joins, leaves and evictions since the last report
+     */
+    void report()
+    {
+        if (joined_ || left_ || evicted_)
+        {
+            info("Clients: %lu live, %" PRIu64 " joined, %" PRIu64
+                 " left, %" PRIu64 " evicted",
+                 table_.size(),
+                 joined_,
+                 left_,
+                 evicted_);
+        }
+        joined_ = left_ = evicted_ = 0;
+    }
+
+private:
+    uint64_t idle_timeout_;
+    ClientTable<ClientEntry> table_;
+    TimingWheel wheel_;
+
+    uint64_t joined_{0};
+    uint64_t left_{0};
+    uint64_t evicted_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,446 @@
+#ifndef NET_CLIENT_TABLE_H_
+#define NET_CLIENT_TABLE_H_
+
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "zeno/common.hpp"
+#include "zeno/debug.hpp"
+#include "zeno/net/header.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief a concurrent hash table from ClientId to a small trivially
+ * copyable Value
+ *
+ * - Open addressing with linear probing over a flat array of slots, so a
+ *   lookup usually touches a single cache line.
+ * - Reads are lock-free: every slot is guarded by a sequence counter, and a
+ *   reader retries the slot if a writer touched it meanwhile.
+ * - Writes lock one of kShardNr shards, picked by the high bits of the hash.
+ *   Each shard is an independent table, growing on its own.
+ *
+ * A grown shard publishes its new array atomically. The old one is kept
+ * until the table is destroyed, so that a concurrent reader never touches
+ * freed memory: as the capacity doubles, the old arrays of a shard take less
+ * room than its live one. A rehash that only drops the tombstones keeps the
+ * capacity and rebuilds the array in place instead, under a per-shard
+ * sequence counter which makes the readers that missed retry. The memory is
+ * thus bounded by the most clients the table ever held at once.
+ *
+ * ~0 and ~0 - 1 mark the empty and erased slots. As ClientId, which come off
+ * the wire, they are kept in two slots of their own.
+ */
+template <typename Value>
+class ClientTable
+{
+public:
+    static constexpr size_t kShardNr = 64;
+    static constexpr ClientId kEmpty = ~0ull;
+    static constexpr ClientId kTombstone = ~0ull - 1;
+
+    explicit ClientTable(size_t expected = 1024)
+    {
+        size_t per_shard = 16;
+        while (per_shard * kShardNr < expected * 2)
+        {
+            per_shard *= 2;
+        }
+        for (auto &shard : shards_)
+        {
+            auto *array = new Array(per_shard);
+            shard.arrays.emplace_back(array);
+            shard.array.store(array, std::memory_order_release);
+        }
+        for (auto &slot : reserved_)
+        {
+            slot.key.store(0, std::memory_order_relaxed);
+        }
+    }
+    ClientTable(const ClientTable &) = delete;
+    ClientTable &operator=(const ClientTable &) = delete;
+
+    /**
+     * @brief lock-free lookup
+     *
+     * @return whether @p id is in the table, in which case *out holds its
+     * value
+     */
+    bool find(ClientId id, Value *out) const
+    {
+        if (unlikely(reserved(id)))
+        {
+            return read(reserved_[id - kTombstone], id, out) == Read::Hit;
+        }
+        uint64_t hash = mix(id);
+        const Shard &shard = shard_of(hash);
+        while (true)
+        {
+            uint32_t version = shard.version.load(std::memory_order_acquire);
+            if (unlikely(version & 1))
+            {
+                continue;
+            }
+            const Array *array = shard.array.load(std::memory_order_acquire);
+            for (size_t i = hash & array->mask;; i = (i + 1) & array->mask)
+            {
+                Read r = read(array->slots[i], id, out);
+                if (r == Read::Hit)
+                {
+                    // the value is right even while the shard is rebuilt.
+                    return true;
+                }
+                if (r == Read::Empty)
+                {
+                    break;
+                }
+            }
+            // a miss only holds if no rebuild moved the entry meanwhile.
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (likely(shard.version.load(std::memory_order_relaxed) ==
+                       version))
+            {
+                return false;
+            }
+        }
+    }
+    bool contains(ClientId id) const
+    {
+        Value v;
+        return find(id, &v);
+    }
+
+    /**
+     * @brief insert @p id, or overwrite its value if already present
+     *
+     * @return true if @p id was not in the table before
+     */
+    bool upsert(ClientId id, const Value &value)
+    {
+        if (unlikely(reserved(id)))
+        {
+            std::lock_guard<std::mutex> lk(reserved_mutex_);
+            Slot &slot = reserved_[id - kTombstone];
+            bool inserted = slot.key.load(std::memory_order_relaxed) != id;
+            write(slot, id, value);
+            size_.fetch_add(inserted ? 1 : 0, std::memory_order_relaxed);
+            return inserted;
+        }
+        uint64_t hash = mix(id);
+        Shard &shard = shard_of(hash);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        Array *array = shard.array.load(std::memory_order_relaxed);
+
+        Slot *free = nullptr;
+        for (size_t i = hash & array->mask;; i = (i + 1) & array->mask)
+        {
+            Slot &slot = array->slots[i];
+            ClientId key = slot.key.load(std::memory_order_relaxed);
+            if (key == id)
+            {
+                write(slot, id, value);
+                return false;
+            }
+            if (key == kTombstone && free == nullptr)
+            {
+                free = &slot;
+            }
+            if (key == kEmpty)
+            {
+                if (free == nullptr)
+                {
+                    free = &slot;
+                    array->used++;
+                }
+                else
+                {
+                    array->tombstones--;
+                }
+                break;
+            }
+        }
+        write(*free, id, value);
+        array->size++;
+        size_.fetch_add(1, std::memory_order_relaxed);
+
+        if ((array->used) * 2 > array->slots.size())
+        {
+            rehash(shard, array);
+        }
+        return true;
+    }
+
+    /**
+     * @brief remove @p id from the table
+     *
+     * @return whether @p id was in the table
+     */
+    bool erase(ClientId id)
+    {
+        if (unlikely(reserved(id)))
+        {
+            std::lock_guard<std::mutex> lk(reserved_mutex_);
+            Slot &slot = reserved_[id - kTombstone];
+            if (slot.key.load(std::memory_order_relaxed) != id)
+            {
+                return false;
+            }
+            write(slot, 0, Value());
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        uint64_t hash = mix(id);
+        Shard &shard = shard_of(hash);
+        std::lock_guard<std::mutex> lk(shard.mutex);
+        Array *array = shard.array.load(std::memory_order_relaxed);
+        for (size_t i = hash & array->mask;; i = (i + 1) & array->mask)
+        {
+            Slot &slot = array->slots[i];
+            ClientId key = slot.key.load(std::memory_order_relaxed);
+            if (key == kEmpty)
+            {
+                return false;
+            }
+            if (key == id)
+            {
+                write(slot, kTombstone, Value());
+                array->size--;
+                array->tombstones++;
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return size_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief call @p f(id, value) on every entry, one shard locked at a time
+     */
+    template <typename F>
+    void for_each(F &&f) const
+    {
+        for (auto &shard : shards_)
+        {
+            std::lock_guard<std::mutex> lk(shard.mutex);
+            const Array *array = shard.array.load(std::memory_order_relaxed);
+            for (const auto &slot : array->slots)
+            {
+                ClientId key = slot.key.load(std::memory_order_relaxed);
+                if (key != kEmpty && key != kTombstone)
+                {
+                    f(key, slot.value);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lk(reserved_mutex_);
+        for (const auto &slot : reserved_)
+        {
+            ClientId key = slot.key.load(std::memory_order_relaxed);
+            if (reserved(key))
+            {
+                f(key, slot.value);
+            }
+        }
+    }
+
+private:
+    static_assert(std::is_trivially_copyable<Value>::value,
+                  "lock-free readers copy Value with memcpy");
+
+    struct Slot
+    {
+        std::atomic<ClientId> key{kEmpty};
+        std::atomic<uint32_t> seq{0};
+        Value value;
+    };
+    struct Array
+    {
+        explicit Array(size_t capacity)
+            : slots(capacity), mask(capacity - 1)
+        {
+        }
+        std::vector<Slot> slots;
+        size_t mask;
+        // occupied or tombstone slots, which bound the probe length
+        size_t used{0};
+        size_t size{0};
+        size_t tombstones{0};
+    };
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::atomic<Array *> array{nullptr};
+        // odd while the array is rebuilt in place
+        std::atomic<uint32_t> version{0};
+        std::vector<std::unique_ptr<Array>> arrays;
+        // keeps the locks of neighbouring shards off the same cache line.
+        // alignas(64) would need C++17 to be honoured by new.
+        char padding[64];
+    };
+
+    static uint64_t mix(uint64_t key)
+    {
+        // the 64-bit finalizer of MurmurHash3
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+    Shard &shard_of(uint64_t hash)
+    {
+        return shards_[hash >> 58];
+    }
+    const Shard &shard_of(uint64_t hash) const
+    {
+        return shards_[hash >> 58];
+    }
+    static_assert(kShardNr == 64, "shard_of() takes the top 6 bits");
+
+    static bool reserved(ClientId id)
+    {
+        return id >= kTombstone;
+    }
+
+    enum class Read
+    {
+        Hit,
+        Miss,
+        Empty,
+    };
+    /**
+     * @brief copy the value of @p slot into @p out if it holds @p id
+     */
+    static Read read(const Slot &slot, ClientId id, Value *out)
+    {
+        while (true)
+        {
+            uint32_t seq = slot.seq.load(std::memory_order_acquire);
+            if (unlikely(seq & 1))
+            {
+                continue;
+            }
+            ClientId key = slot.key.load(std::memory_order_relaxed);
+            if (key != id)
+            {
+                return key == kEmpty ? Read::Empty : Read::Miss;
+            }
+            memcpy(out, &slot.value, sizeof(Value));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (likely(slot.seq.load(std::memory_order_relaxed) == seq))
+            {
+                return Read::Hit;
+            }
+        }
+    }
+
+    static void write(Slot &slot, ClientId key, const Value &value)
+    {
+        uint32_t seq = slot.seq.load(std::memory_order_relaxed);
+        slot.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.key.store(key, std::memory_order_relaxed);
+        memcpy(&slot.value, &value, sizeof(Value));
+        slot.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief drop the tombstones of @p old: in place if most of the used slots
+     * were tombstones, or else by moving the live entries into a new array of
+     * twice the capacity
+     */
+    void rehash(Shard &shard, Array *old)
+    {
+        size_t capacity = old->slots.size();
+        if (old->size * 4 <= capacity)
+        {
+            rebuild(shard, old);
+            return;
+        }
+        auto *array = new Array(capacity * 2);
+        for (const auto &slot : old->slots)
+        {
+            ClientId key = slot.key.load(std::memory_order_relaxed);
+            if (key == kEmpty || key == kTombstone)
+            {
+                continue;
+            }
+            size_t i = mix(key) & array->mask;
+            while (array->slots[i].key.load(std::memory_order_relaxed) != kEmpty)
+            {
+                i = (i + 1) & array->mask;
+            }
+            array->slots[i].key.store(key, std::memory_order_relaxed);
+            memcpy(&array->slots[i].value, &slot.value, sizeof(Value));
+            array->used++;
+            array->size++;
+        }
+        shard.arrays.emplace_back(array);
+        shard.array.store(array, std::memory_order_release);
+    }
+
+    /**
+     * @brief clear @p array and insert its live entries again
+     */
+    void rebuild(Shard &shard, Array *array)
+    {
+        std::vector<std::pair<ClientId, Value>> live;
+        live.reserve(array->size);
+        for (const auto &slot : array->slots)
+        {
+            ClientId key = slot.key.load(std::memory_order_relaxed);
+            if (key != kEmpty && key != kTombstone)
+            {
+                live.emplace_back(key, slot.value);
+            }
+        }
+
+        uint32_t version = shard.version.load(std::memory_order_relaxed);
+        shard.version.store(version + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (auto &slot : array->slots)
+        {
+            if (slot.key.load(std::memory_order_relaxed) != kEmpty)
+            {
+                write(slot, kEmpty, Value());
+            }
+        }
+        for (const auto &entry : live)
+        {
+            size_t i = mix(entry.first) & array->mask;
+            while (array->slots[i].key.load(std::memory_order_relaxed) != kEmpty)
+            {
+                i = (i + 1) & array->mask;
+            }
+            write(array->slots[i], entry.first, entry.second);
+        }
+        array->used = live.size();
+        array->size = live.size();
+        array->tombstones = 0;
+        shard.version.store(version + 2, std::memory_order_release);
+    }
+
+    Shard shards_[kShardNr];
+    // the values of kTombstone and kEmpty, present if the key holds the id
+    Slot reserved_[2];
+    mutable std::mutex reserved_mutex_;
+    std::atomic<size_t> size_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
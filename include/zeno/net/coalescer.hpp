@@ -0,0 +1,156 @@
+#ifndef NET_COALESCER_H_
+#define NET_COALESCER_H_
+
+#include <string.h>
+
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/header.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief pack small messages into Frame packets on the sending side
+ *
+ * Messages are appended to an open frame, which is handed to the flush
+ * callback when the next message would not fit in max_datagram bytes, or
+ * when poll() finds its oldest message older than max_delay. The callback is
+ * called once per datagram, not once per message.
+ *
+ *   Coalescer c(id, 1400, std::chrono::microseconds(50),
+ *               [&](const char *data, size_t len) { sock.send_to(...); });
+ *   c.append(msg, msg_len);
+ *   ...
+ *   c.poll();
+ */
+class Coalescer
+{
+public:
+    using Flush = std::function<void(const char *data, size_t length)>;
+    using Clock = std::chrono::steady_clock;
+
+    Coalescer(ClientId client_id,
+              size_t max_datagram,
+              Clock::duration max_delay,
+              Flush flush)
+        : client_id_(client_id),
+          max_delay_(max_delay),
+          flush_(std::move(flush)),
+          buffer_(max_datagram)
+    {
+        check(max_datagram > kFrameOverhead + sizeof(MessageLength),
+              "max_datagram %lu cannot hold a single message",
+              max_datagram);
+        reset();
+    }
+
+    /**
+     * @brief the largest message that append() accepts
+     */
+    size_t max_message() const
+    {
+        return buffer_.size() - kFrameOverhead - sizeof(MessageLength);
+    }
+
+    /**
+     * @brief reserve room for a message of @p length bytes in the frame
+     *
+     * Flushes the open frame first if the message does not fit. The message
+     * must be written to the returned pointer before the next call.
+     */
+    char *reserve(size_t length)
+    {
+        check(length <= max_message(),
+              "message of %lu bytes exceeds %lu",
+              length,
+              max_message());
+        if (size_ + sizeof(MessageLength) + length > buffer_.size())
+        {
+            flush();
+        }
+        if (message_nr_ == 0)
+        {
+            oldest_ = Clock::now();
+        }
+        MessageLength len = length;
+        memcpy(buffer_.data() + size_, &len, sizeof(len));
+        char *ret = buffer_.data() + size_ + sizeof(len);
+        size_ += sizeof(len) + length;
+        message_nr_++;
+        return ret;
+    }
+
+    void append(const char *data, size_t length)
+    {
+        memcpy(reserve(length), data, length);
+    }
+
+    /**
+     * @brief flush the open frame if it has waited longer than max_delay
+     *
+     * @return whether a frame was flushed
+     */
+    bool poll()
+    {
+        if (message_nr_ != 0 && Clock::now() - oldest_ >= max_delay_)
+        {
+            flush();
+            return true;
+        }
+        return false;
+    }
+
+    void flush()
+    {
+        if (message_nr_ == 0)
+        {
+            return;
+        }
+        auto *header = (PacketHeader *) buffer_.data();
+        header->packet_length = size_;
+        header->checksum = 0;
+        header->client_id = client_id_;
+        header->packet_type = PacketType::Frame;
+        FrameHeader frame;
+        frame.message_nr = message_nr_;
+        memcpy(buffer_.data() + sizeof(PacketHeader), &frame, sizeof(frame));
+
+        flush_(buffer_.data(), size_);
+        frames_++;
+        reset();
+    }
+
+    size_t pending() const
+    {
+        return message_nr_;
+    }
+    uint64_t frames() const
+    {
+        return frames_;
+    }
+
+private:
+    void reset()
+    {
+        size_ = kFrameOverhead;
+        message_nr_ = 0;
+    }
+
+    ClientId client_id_;
+    Clock::duration max_delay_;
+    Flush flush_;
+    std::vector<char> buffer_;
+    size_t size_{0};
+    uint16_t message_nr_{0};
+    Clock::time_point oldest_;
+    uint64_t frames_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef NET_HANDLER_H_
+#define NET_HANDLER_H_
+
+#include <cstddef>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/header.hpp"
+#include "zeno/net/parser.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief the request handler every transport calls
+ *
+ * A handler gets one whole packet, header included, writes the response in
+ * place over it and returns the response length, which must not exceed the
+ * request length. Transports thus never copy between receiving and sending.
+ *
+ * The response is a packet too: stream transports frame it by its
+ * packet_length, which the handler must keep in sync, and its checksum,
+ * which must be resealed if set. A zero length means no response.
+ *
+ * Handlers are called directly, through a template parameter of the
+ * transport, so they cost no indirect call. See Dispatcher to route by
+ * PacketType.
+ */
+struct EchoHandler
+{
+    size_t operator()(char * /* packet */, size_t length) const
+    {
+        return length;
+    }
+};
+
+/**
+ * @brief the body of a request, as seen by a route: a view into the packet,
+ * where the response body is written in place
+ */
+struct Body
+{
+    ClientId client_id;
+    char *data;
+    size_t length;
+};
+
+/**
+ * @brief bind @p Handler to the packets of type @p Type
+ *
+ * The handler is called as size_t(Body), and returns the length of the
+ * response body written over body.data, at most body.length. The header is
+ * kept, and its packet_length and checksum updated by the Dispatcher.
+ */
+template <PacketType Type, typename Handler>
+struct Route
+{
+    static constexpr PacketType type = Type;
+    using handler_type = Handler;
+};
+
+/**
+ * @brief a route echoing the body untouched
+ */
+struct EchoBody
+{
+    size_t operator()(Body body) const
+    {
+        return body.length;
+    }
+};
+
+namespace detail
+{
+template <PacketType Type, typename... Routes>
+struct Routed;
+template <PacketType Type>
+struct Routed<Type>
+{
+    static constexpr bool value = false;
+};
+template <PacketType Type, typename R, typename... Rest>
+struct Routed<Type, R, Rest...>
+{
+    static constexpr bool value = R::type == Type || Routed<Type, Rest...>::value;
+};
+
+template <typename... Routes>
+class RouteTable;
+template <>
+class RouteTable<>
+{
+public:
+    static constexpr size_t kNoRoute = (size_t) -1;
+
+    size_t dispatch(PacketType /* type */, Body /* body */)
+    {
+        return kNoRoute;
+    }
+};
+/**
+ * @brief one handler per level of inheritance: dispatch() unrolls into a
+ * chain of compares the compiler sees through, with every handler inlined
+ */
+template <typename R, typename... Rest>
+class RouteTable<R, Rest...> : private RouteTable<Rest...>
+{
+    static_assert(!Routed<R::type, Rest...>::value,
+                  "a PacketType is routed twice");
+
+public:
+    RouteTable() = default;
+    explicit RouteTable(typename R::handler_type handler,
+                        typename Rest::handler_type... rest)
+        : RouteTable<Rest...>(rest...), handler_(handler)
+    {
+    }
+
+    size_t dispatch(PacketType type, Body body)
+    {
+        if (type == R::type)
+        {
+            return handler_(body);
+        }
+        return RouteTable<Rest...>::dispatch(type, body);
+    }
+
+private:
+    typename R::handler_type handler_;
+};
+}  // namespace detail
+
+/**
+ * @brief a handler for the transports, dispatching on the PacketType at
+ * compile time
+ *
+ *   using Handler = Dispatcher<Route<PacketType::Normal, Get>,
+ *                              Route<PacketType::Frame, Batch>>;
+ *   basic_server<Handler> s(io_context, port, options, Handler(get, batch));
+ *
+ * Packets of a type without a route, or shorter than a header, get no
+ * response. The transports then send nothing.
+ */
+template <typename... Routes>
+class Dispatcher
+{
+public:
+    Dispatcher() = default;
+    explicit Dispatcher(typename Routes::handler_type... handlers)
+        : routes_(handlers...)
+    {
+    }
+
+    size_t operator()(char *packet, size_t length)
+    {
+        if (unlikely(length < sizeof(PacketHeader)))
+        {
+            return 0;
+        }
+        Body body{ParseClientId(packet),
+                  ParsePacketBody(packet),
+                  length - sizeof(PacketHeader)};
+        size_t response = routes_.dispatch(ParsePacketType(packet), body);
+        if (response == detail::RouteTable<>::kNoRoute)
+        {
+            return 0;
+        }
+        dcheck(response <= body.length);
+        auto *header = (PacketHeader *) packet;
+        header->packet_length = sizeof(PacketHeader) + response;
+        // a checksummed request gets a checksummed response
+        if (header->checksum != 0)
+        {
+            SealPacket(packet, sizeof(PacketHeader) + response);
+        }
+        return sizeof(PacketHeader) + response;
+    }
+
+private:
+    detail::RouteTable<Routes...> routes_;
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -2,32 +2,65 @@
 #define HEADER_H_
 
 #include <inttypes.h>
+#include <stddef.h>
 
 namespace zeno
 {
 namespace net
 {
 /**
- * 0-8:   PacketLength
+ * 0-4:   PacketLength
+ * 4-8:   Checksum, the CRC32C of all the other bytes of the packet, or 0
+ *        if the sender did not compute one. See SealPacket().
  * 8-16:  ClientId
- * 16-24: PacketType
+ * 16-17: PacketType
+ *
+ * The checksum took the upper half of what was a 64-bit length, so that
+ * packets without one are byte for byte what they always were.
  */
-using PacketLength = uint64_t;
+using PacketLength = uint32_t;
+using Checksum = uint32_t;
 using ClientId = uint64_t;
 enum class PacketType : uint8_t
 {
     Normal = 1,
     Join = 2,
     Leave = 3,
+    Frame = 4,
+    // the answer of an overloaded server to a request it sheds, carrying
+    // the request header and the first kOverloadEcho bytes of its body
+    Overload = 5,
 };
 
 struct PacketHeader
 {
     PacketLength packet_length;
+    Checksum checksum;
     ClientId client_id;
     PacketType packet_type;
 } __attribute__((packed));
 
+/**
+ * A Frame packet carries many logical messages in one datagram:
+ *
+ * 0-17:  PacketHeader, with packet_type = Frame
+ * 17-19: FrameHeader
+ * 19-:   message_nr times [MessageLength][message body]
+ */
+using MessageLength = uint16_t;
+
+struct FrameHeader
+{
+    uint16_t message_nr;
+} __attribute__((packed));
+
+constexpr size_t kFrameOverhead = sizeof(PacketHeader) + sizeof(FrameHeader);
+
+// enough of the body for a client to match an Overload to its request
+constexpr size_t kOverloadEcho = 8;
+
+static_assert(sizeof(PacketHeader) == 17, "PacketHeader layout");
+
 }  // namespace net
 }  // namespace zeno
 
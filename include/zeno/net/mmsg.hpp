@@ -0,0 +1,324 @@
+#ifndef NET_MMSG_H_
+#define NET_MMSG_H_
+
+#include <errno.h>
+#include <netinet/udp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/timestamps.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief a batch of datagram slots for recvmmsg/sendmmsg
+ *
+ * Every slot owns a fixed-size buffer and room for the peer address, so a
+ * batch received by recv() can be answered in place by send(): the kernel
+ * fills msg_name with the sender, which is exactly the destination of the
+ * reply.
+ *
+ * With @p offload, every slot also gets room for control messages: recv()
+ * picks up the segment size of UDP GRO super-packets, and send() attaches
+ * UDP_SEGMENT to the slots given a segment size, so that the kernel splits
+ * them back. The socket needs UDP_GRO itself, see EnableGro().
+ *
+ * With @p timestamps, recv() also keeps the software RX timestamp of every
+ * datagram, and send() can ask for a TX timestamp per slot. The socket
+ * needs EnableTimestamping().
+ */
+class MsgBatch
+{
+public:
+    // the largest UDP payload, which is what a GRO super-packet can reach
+    static constexpr size_t kMaxSuperPacket = 65507;
+
+    MsgBatch(size_t capacity,
+             size_t buffer_size,
+             bool offload = false,
+             bool timestamps = false)
+        : buffer_size_(buffer_size),
+          buffers_(capacity * buffer_size),
+          iovecs_(capacity),
+          names_(capacity),
+          msgs_(capacity),
+          controls_(offload || timestamps ? capacity : 0),
+          segment_sizes_(capacity),
+          tx_stamps_(capacity),
+          offload_(offload),
+          timestamps_(timestamps)
+    {
+        check(capacity > 0, "batch capacity should be positive");
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            iovecs_[i].iov_base = buffers_.data() + i * buffer_size_;
+            iovecs_[i].iov_len = buffer_size_;
+
+            memset(&msgs_[i], 0, sizeof(mmsghdr));
+            msgs_[i].msg_hdr.msg_iov = &iovecs_[i];
+            msgs_[i].msg_hdr.msg_iovlen = 1;
+            msgs_[i].msg_hdr.msg_name = &names_[i];
+            msgs_[i].msg_hdr.msg_namelen = sizeof(sockaddr_storage);
+        }
+    }
+
+    bool offload() const
+    {
+        return offload_;
+    }
+    bool timestamps() const
+    {
+        return timestamps_;
+    }
+
+    size_t capacity() const
+    {
+        return msgs_.size();
+    }
+    size_t buffer_size() const
+    {
+        return buffer_size_;
+    }
+
+    /**
+     * @brief drain up to capacity() datagrams from @p fd
+     *
+     * @return number of datagrams received, or -1 with errno set
+     */
+    int recv(int fd, int flags = MSG_DONTWAIT)
+    {
+        for (size_t i = 0; i < msgs_.size(); ++i)
+        {
+            msghdr &hdr = msgs_[i].msg_hdr;
+            hdr.msg_iov->iov_len = buffer_size_;
+            hdr.msg_namelen = sizeof(sockaddr_storage);
+            if (!controls_.empty())
+            {
+                hdr.msg_control = &controls_[i];
+                hdr.msg_controllen = sizeof(Control);
+            }
+            segment_sizes_[i] = 0;
+            tx_stamps_[i] = false;
+        }
+        return ::recvmmsg(fd, msgs_.data(), msgs_.size(), flags, nullptr);
+    }
+
+    /**
+     * @brief send slots [first, first + nr) to their msg_name
+     *
+     * The length of each slot is the one set by set_length(), or the received
+     * length if untouched.
+     *
+     * @return number of datagrams sent, or -1 with errno set
+     */
+    int send(int fd, size_t first, size_t nr, int flags = MSG_DONTWAIT)
+    {
+        dcheck(first + nr <= msgs_.size());
+        for (size_t i = first; i < first + nr; ++i)
+        {
+            iovecs_[i].iov_len = msgs_[i].msg_len;
+            if (!controls_.empty())
+            {
+                attach_control(i);
+            }
+        }
+        return ::sendmmsg(fd, msgs_.data() + first, nr, flags);
+    }
+
+    /**
+     * @brief the segment size of the GRO super-packet in slot @p i, or its
+     * length if the kernel did not coalesce it
+     */
+    size_t segment_size(size_t i) const
+    {
+        if (!offload())
+        {
+            return length(i);
+        }
+        const msghdr &hdr = msgs_[i].msg_hdr;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR((msghdr *) &hdr, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+            {
+                int size;
+                memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                return size;
+            }
+        }
+        return length(i);
+    }
+    /**
+     * @brief have send() split slot @p i into datagrams of @p size bytes,
+     * with UDP_SEGMENT. Only with offload.
+     */
+    void set_segment_size(size_t i, size_t size)
+    {
+        dcheck(offload());
+        segment_sizes_[i] = size;
+    }
+
+    /**
+     * @brief the software RX timestamp of slot @p i, 0 if none. Only with
+     * timestamps.
+     */
+    uint64_t rx_timestamp(size_t i) const
+    {
+        return timestamps_ ? ParseRxTimestamp(msgs_[i].msg_hdr) : 0;
+    }
+    /**
+     * @brief have the kernel stamp slot @p i when it leaves, to be read back
+     * with DrainTxTimestamps(). Only with timestamps.
+     */
+    void request_tx_timestamp(size_t i)
+    {
+        dcheck(timestamps_);
+        tx_stamps_[i] = true;
+    }
+
+    char *data(size_t i)
+    {
+        return (char *) iovecs_[i].iov_base;
+    }
+    size_t length(size_t i) const
+    {
+        return msgs_[i].msg_len;
+    }
+    void set_length(size_t i, size_t length)
+    {
+        dcheck(length <= buffer_size_);
+        msgs_[i].msg_len = length;
+    }
+    const sockaddr *name(size_t i) const
+    {
+        return (const sockaddr *) &names_[i];
+    }
+    socklen_t namelen(size_t i) const
+    {
+        return msgs_[i].msg_hdr.msg_namelen;
+    }
+    /**
+     * @brief address slot @p i to @p name, to send() without a recv() first
+     */
+    void set_name(size_t i, const sockaddr *name, socklen_t namelen)
+    {
+        dcheck(namelen <= sizeof(sockaddr_storage));
+        memcpy(&names_[i], name, namelen);
+        msgs_[i].msg_hdr.msg_namelen = namelen;
+    }
+    /**
+     * @brief whether the datagram in slot @p i was cut to buffer_size()
+     */
+    bool truncated(size_t i) const
+    {
+        return msgs_[i].msg_hdr.msg_flags & MSG_TRUNC;
+    }
+
+private:
+    // room for UDP_GRO and SCM_TIMESTAMPING on receive, UDP_SEGMENT and
+    // SO_TIMESTAMPING on send
+    union Control
+    {
+        char buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(scm_timestamping))];
+        cmsghdr align;
+    };
+
+    void attach_control(size_t i)
+    {
+        msghdr &hdr = msgs_[i].msg_hdr;
+        bool segment =
+            segment_sizes_[i] != 0 && segment_sizes_[i] < msgs_[i].msg_len;
+        size_t length = (segment ? CMSG_SPACE(sizeof(uint16_t)) : 0) +
+                        (tx_stamps_[i] ? CMSG_SPACE(sizeof(uint32_t)) : 0);
+        if (length == 0)
+        {
+            hdr.msg_control = nullptr;
+            hdr.msg_controllen = 0;
+            return;
+        }
+        // CMSG_NXTHDR reads the next header, which must not be stale.
+        memset(&controls_[i], 0, sizeof(Control));
+        hdr.msg_control = &controls_[i];
+        hdr.msg_controllen = length;
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        if (segment)
+        {
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t size = segment_sizes_[i];
+            memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+            cmsg = CMSG_NXTHDR(&hdr, cmsg);
+        }
+        if (tx_stamps_[i])
+        {
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SO_TIMESTAMPING;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+            uint32_t flags = SOF_TIMESTAMPING_TX_SOFTWARE;
+            memcpy(CMSG_DATA(cmsg), &flags, sizeof(flags));
+        }
+    }
+
+    size_t buffer_size_;
+    std::vector<char> buffers_;
+    std::vector<iovec> iovecs_;
+    std::vector<sockaddr_storage> names_;
+    std::vector<mmsghdr> msgs_;
+    std::vector<Control> controls_;
+    std::vector<size_t> segment_sizes_;
+    std::vector<bool> tx_stamps_;
+    bool offload_;
+    bool timestamps_;
+};
+
+/**
+ * @brief ask the kernel to coalesce the datagrams of a flow into GRO
+ * super-packets on @p fd
+ *
+ * @return whether the kernel supports it
+ */
+inline bool EnableGro(int fd)
+{
+    int one = 1;
+    if (setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) != 0)
+    {
+        warn("failed to enable UDP_GRO: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief call @p f(data, length) on each datagram of a GRO super-packet of
+ * @p length bytes cut in @p segment_size pieces. The last one may be
+ * shorter.
+ */
+template <typename F>
+inline size_t ForEachSegment(char *data,
+                             size_t length,
+                             size_t segment_size,
+                             F &&f)
+{
+    if (segment_size == 0)
+    {
+        segment_size = length;
+    }
+    size_t nr = 0;
+    for (size_t pos = 0; pos < length; pos += segment_size, ++nr)
+    {
+        f(data + pos, std::min(segment_size, length - pos));
+    }
+    return nr;
+}
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -7,28 +7,35 @@
 #include <boost/asio/ip/udp.hpp>
 #include <boost/asio/strand.hpp>
 #include <boost/bind.hpp>
-#include <boost/enable_shared_from_this.hpp>
-#include <boost/make_shared.hpp>
-#include <boost/shared_ptr.hpp>
-#include <unordered_map>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
 
 #include "zeno/debug.hpp"
+#include "zeno/net/address.hpp"
+#include "zeno/net/admission.hpp"
+#include "zeno/net/client-table.hpp"
+#include "zeno/net/handler.hpp"
 #include "zeno/net/header.hpp"
+#include "zeno/net/options.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/net/session-pool.hpp"
+#include "zeno/net/timestamps.hpp"
 
 namespace zeno
 {
 namespace net
 {
 using boost::asio::ip::udp;
-class MultithreadServer;
 
-class UDPSession : public boost::enable_shared_from_this<UDPSession>
+/**
+ * @brief one request in flight, recycled through a per-thread ObjectPool
+ *
+ * Sessions are reference counted intrusively, and return to the pool of the
+ * thread that drops the last reference.
+ */
+class UDPSession
 {
 public:
-    UDPSession(MultithreadServer *server) : server_(server)
-    {
-    }
-    void handle_request(const boost::system::error_code &ec);
+    using Pool = ObjectPool<UDPSession>;
 
     void handle_sent(const boost::system::error_code &ec, std::size_t)
     {
@@ -41,31 +48,147 @@ public:
     {
         return remote_endpoint_;
     }
+    const udp::endpoint &remote_endpoint() const
+    {
+        return remote_endpoint_;
+    }
     std::array<char, 2048> &buffer()
     {
         return recv_buffer_;
     }
-    std::string message()
+
+    /**
+     * @brief the received datagram, which is also where the reply is built
+     */
+    char *data()
+    {
+        return recv_buffer_.data();
+    }
+    const char *data() const
+    {
+        return recv_buffer_.data();
+    }
+    size_t length() const
+    {
+        return recv_length_;
+    }
+    /**
+     * @brief record how many bytes were received.
+     *
+     * The response defaults to the same bytes, so an untouched session echoes.
+     */
+    void set_length(size_t length)
+    {
+        recv_length_ = length;
+        response_length_ = length;
+    }
+    /**
+     * @brief make the first @p length bytes of data() the reply.
+     *
+     * Handlers write the response in place over the request, so nothing is
+     * copied between receiving and sending.
+     */
+    void set_response_length(size_t length)
+    {
+        dcheck(length <= recv_buffer_.size());
+        response_length_ = length;
+    }
+    boost::asio::const_buffer response() const
+    {
+        return boost::asio::buffer(recv_buffer_.data(), response_length_);
+    }
+
+    /**
+     * @brief mark the request as admitted for @p client_id, to be released
+     * once answered
+     */
+    void set_admitted(ClientId client_id)
+    {
+        admitted_ = true;
+        client_id_ = client_id;
+    }
+    bool admitted() const
+    {
+        return admitted_;
+    }
+    ClientId client_id() const
     {
-        return message_;
+        return client_id_;
+    }
+
+    /**
+     * @brief when the last stage of a sampled request ended, 0 if the
+     * request is not sampled
+     */
+    uint64_t stamp() const
+    {
+        return stamp_;
+    }
+    void set_stamp(uint64_t ns)
+    {
+        stamp_ = ns;
+    }
+
+    friend void intrusive_ptr_add_ref(UDPSession *session)
+    {
+        session->ref_.fetch_add(1, std::memory_order_relaxed);
+    }
+    friend void intrusive_ptr_release(UDPSession *session)
+    {
+        if (session->ref_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            Pool::local().release(session);
+        }
     }
 
 private:
-    MultithreadServer *server_{nullptr};
+    std::atomic<uint32_t> ref_{0};
     udp::endpoint remote_endpoint_;
     std::array<char, 2048> recv_buffer_;
-    std::string message_;
+    size_t recv_length_{0};
+    size_t response_length_{0};
+    bool admitted_{false};
+    ClientId client_id_{0};
+    uint64_t stamp_{0};
 };
 
-class MultithreadServer
+using UDPSessionPtr = boost::intrusive_ptr<UDPSession>;
+
+/**
+ * @brief a UDP server whose requests are handled by @p Handler on every
+ * thread running the io_context
+ *
+ * Receiving and sending go through a strand, handling does not: the handler
+ * must be safe to call concurrently. See handler.hpp for its contract.
+ *
+ * With ServerOptions::admission, requests are admitted on the strand before
+ * being queued to the workers, which bounds the queue; shed requests are
+ * answered with an Overload packet, or dropped.
+ *
+ * With ServerOptions::timestamp_sample, the sampled requests are broken
+ * down by Stage, from the RX timestamp read with SIOCGSTAMPNS to the
+ * completion of the send.
+ */
+template <typename Handler = EchoHandler>
+class BasicMultithreadServer
 {
 public:
-    MultithreadServer(boost::asio::io_context &io_context, short port)
+    BasicMultithreadServer(boost::asio::io_context &io_context,
+                           short port,
+                           const ServerOptions &options = ServerOptions(),
+                           Handler handler = Handler())
         : socket_(io_context, udp::endpoint(udp::v4(), port)),
           strand_(io_context),
-          deadline_(io_context)
+          deadline_(io_context),
+          handler_(handler),
+          breakdown_(options.timestamp_sample),
+          admission_(options.admission),
+          reply_overload_(options.admission.reply_overload)
     {
         info("Server is listening on 0.0.0.0:%d", port);
+        info_if(admission_.enabled(),
+                "Admission control: at most %lu requests in flight",
+                options.admission.max_inflight);
         deadline_.expires_from_now(boost::posix_time::seconds(1));
 
         check_timeout();
@@ -78,6 +201,19 @@ public:
             boost::asio::deadline_timer::traits_type::now())
         {
             dinfo("Heartbeat one second.");
+            report_pool();
+            breakdown_.report();
+            if (admission_.enabled())
+            {
+                strand_.post([this]() {
+                    admission_.report();
+                    admission_.sweep();
+                    info_if(overload_replies_ != 0,
+                            "Answered %" PRIu64 " shed requests with Overload",
+                            overload_replies_);
+                    overload_replies_ = 0;
+                });
+            }
             deadline_.expires_from_now(boost::posix_time::seconds(1));
         }
         deadline_.async_wait([&](boost::system::error_code ec) {
@@ -94,7 +230,7 @@ public:
 
     void receive_session()
     {
-        auto session = boost::make_shared<UDPSession>(this);
+        UDPSessionPtr session(UDPSession::Pool::local().acquire());
 
         socket_.async_receive_from(
             boost::asio::buffer(session->buffer()),
@@ -105,23 +241,76 @@ public:
             }));
     }
 
-    void enqueue_response(const boost::shared_ptr<UDPSession> &session)
+    /**
+     * @brief record the client of @p session. Safe from any thread.
+     */
+    void remember(const UDPSession &session)
     {
+        if (session.length() < sizeof(PacketHeader))
+        {
+            return;
+        }
+        auto client_id = ParseClientId(session.data());
+        if (clients_.contains(client_id))
+        {
+            return;
+        }
+        if (clients_.upsert(client_id,
+                            ClientAddress::from(session.remote_endpoint())))
+        {
+            const auto &endpoint = session.remote_endpoint();
+            info("Permanently add (%" PRIu64 ", %s:%d) into known clients",
+                 client_id,
+                 endpoint.address().to_string().c_str(),
+                 endpoint.port());
+        }
+    }
+
+    void enqueue_response(const UDPSessionPtr &session)
+    {
+        // the handler holds a reference, so the session goes back to the
+        // pool only once the send has completed.
         socket_.async_send_to(
-            boost::asio::buffer(session->message()),
+            session->response(),
             session->remote_endpoint(),
-            strand_.wrap([&](const boost::system::error_code &ec,
-                             std::size_t recv_bytes) {
+            strand_.wrap([this, session](const boost::system::error_code &ec,
+                                         std::size_t recv_bytes) {
                 session->handle_sent(ec, recv_bytes);
+                if (session->stamp() != 0)
+                {
+                    breakdown_.record(
+                        Stage::Send, session->stamp(), RealtimeNs());
+                }
+                if (session->admitted())
+                {
+                    admission_.release(session->client_id());
+                }
             }));
     }
 
-    void handle_receive(boost::shared_ptr<UDPSession> session,
+    void handle_receive(UDPSessionPtr session,
                         const boost::system::error_code &ec,
-                        std::size_t)
+                        std::size_t bytes_recvd)
     {
-        boost::asio::post(socket_.get_executor(),
-                          [&ec, session]() { session->handle_request(ec); });
+        session->set_length(bytes_recvd);
+        if ((!ec || ec == boost::asio::error::message_size) && !admit(*session))
+        {
+            shed(session);
+        }
+        else
+        {
+            if (!ec && breakdown_.sample())
+            {
+                uint64_t now = RealtimeNs();
+                breakdown_.record(Stage::KernelRx,
+                                  LastRxTimestamp(socket_.native_handle()),
+                                  now);
+                session->set_stamp(now);
+            }
+            boost::asio::post(socket_.get_executor(), [this, ec, session]() {
+                handle_request(session, ec);
+            });
+        }
         receive_session();
     }
 
@@ -135,9 +324,105 @@ public:
     }
 
 private:
+    /**
+     * @brief run the handler over the request of @p session and send what
+     * it wrote in place, if anything
+     */
+    void handle_request(const UDPSessionPtr &session,
+                        const boost::system::error_code &ec)
+    {
+        if (ec && ec != boost::asio::error::message_size)
+        {
+            return;
+        }
+        remember(*session);
+        uint64_t start = 0;
+        if (session->stamp() != 0)
+        {
+            start = RealtimeNs();
+            breakdown_.record(Stage::Queue, session->stamp(), start);
+        }
+        size_t response = handler_(session->data(), session->length());
+        if (start != 0)
+        {
+            session->set_stamp(RealtimeNs());
+            breakdown_.record(Stage::Handler, start, session->stamp());
+        }
+        if (response != 0)
+        {
+            session->set_response_length(response);
+            enqueue_response(session);
+        }
+        else if (session->admitted())
+        {
+            ClientId client_id = session->client_id();
+            strand_.post([this, client_id]() { admission_.release(client_id); });
+        }
+    }
+
+    /**
+     * @brief admit the request of @p session, on the strand
+     */
+    bool admit(UDPSession &session)
+    {
+        if (!admission_.enabled() || session.length() < sizeof(PacketHeader))
+        {
+            return true;
+        }
+        ClientId client_id = ParseClientId(session.data());
+        if (!admission_.admit(client_id))
+        {
+            return false;
+        }
+        session.set_admitted(client_id);
+        return true;
+    }
+
+    /**
+     * @brief answer a shed request with an Overload packet: its header and
+     * the start of its body, for the client to match
+     */
+    void shed(const UDPSessionPtr &session)
+    {
+        if (!reply_overload_)
+        {
+            return;
+        }
+        size_t body = session->length() - sizeof(PacketHeader);
+        size_t length =
+            sizeof(PacketHeader) + (body < kOverloadEcho ? body : kOverloadEcho);
+        auto *header = (PacketHeader *) session->data();
+        header->packet_type = PacketType::Overload;
+        header->packet_length = length;
+        if (header->checksum != 0)
+        {
+            SealPacket(session->data(), length);
+        }
+        session->set_response_length(length);
+        enqueue_response(session);
+        overload_replies_++;
+    }
+
+    /**
+     * @brief report the session pool activity of the last second.
+     *
+     * In steady state every session is recycled, so mallocs stay at zero.
+     */
+    void report_pool()
+    {
+        auto stats = UDPSession::Pool::stats();
+        info("Session pool: %" PRIu64 " mallocs, %" PRIu64 " frees, %" PRIu64
+             " reuses in the last second, %" PRIu64 " cached",
+             stats.mallocs - last_pool_stats_.mallocs,
+             stats.frees - last_pool_stats_.frees,
+             stats.reuses - last_pool_stats_.reuses,
+             stats.cached);
+        last_pool_stats_ = stats;
+    }
+
     udp::socket socket_;
     udp::endpoint sender_endpoint_;
-    std::unordered_map<zeno::net::ClientId, udp::endpoint> endpoint_map_;
+    ClientTable<ClientAddress> clients_;
 
     boost::asio::io_service::strand strand_;
 
@@ -147,16 +432,18 @@ private:
         max_length = 1024
     };
     char data_[max_length];
-};
 
-void UDPSession::handle_request(const boost::system::error_code &ec)
+    Handler handler_;
+    PoolStats last_pool_stats_;
+    LatencyBreakdown breakdown_;
 
-{
-    if (!ec || ec == boost::asio::error::message_size)
-    {
-        server_->enqueue_response(shared_from_this());
-    }
-}
+    // only touched on the strand
+    Admission admission_;
+    bool reply_overload_;
+    uint64_t overload_replies_{0};
+};
+
+using MultithreadServer = BasicMultithreadServer<>;
 }  // namespace net
 }  // namespace zeno
 #endif
\ No newline at end of file
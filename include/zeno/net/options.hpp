@@ -0,0 +1,166 @@
+#ifndef NET_OPTIONS_H_
+#define NET_OPTIONS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief the I/O engine a server is built on
+ */
+enum class Backend
+{
+    // epoll, through the boost::asio reactor
+    Asio,
+    // io_uring with multishot recvmsg and a provided buffer ring
+    IoUring,
+    // a pinned thread spinning on a non-blocking socket
+    BusyPoll,
+    // shared memory rings, for clients on the same host only
+    Shm,
+};
+
+inline Backend ParseBackend(const std::string &name)
+{
+    if (name == "asio")
+    {
+        return Backend::Asio;
+    }
+    if (name == "busy")
+    {
+        return Backend::BusyPoll;
+    }
+    if (name == "shm")
+    {
+        return Backend::Shm;
+    }
+    check(name == "uring",
+          "unknown backend %s, expect asio, uring, busy or shm",
+          name.c_str());
+    return Backend::IoUring;
+}
+
+/**
+ * @brief which requests an overloaded server sheds
+ */
+enum class ShedPolicy
+{
+    // whatever arrives once max_inflight requests are in flight
+    DropNewest,
+    // the requests of clients above their fair share of max_inflight
+    DropByClient,
+    // the requests of clients out of tokens, each client having a bucket
+    TokenBucket,
+};
+
+inline ShedPolicy ParseShedPolicy(const std::string &name)
+{
+    if (name == "client")
+    {
+        return ShedPolicy::DropByClient;
+    }
+    if (name == "bucket")
+    {
+        return ShedPolicy::TokenBucket;
+    }
+    check(name == "newest",
+          "unknown shedding policy %s, expect newest, client or bucket",
+          name.c_str());
+    return ShedPolicy::DropNewest;
+}
+
+/**
+ * @brief admission control of the servers queueing requests
+ */
+struct AdmissionOptions
+{
+    /**
+     * max number of requests admitted and not yet answered. 0 admits all.
+     */
+    size_t max_inflight{0};
+    ShedPolicy policy{ShedPolicy::DropNewest};
+    /**
+     * ShedPolicy::TokenBucket only: requests per second and burst allowed
+     * to each ClientId.
+     */
+    double client_rate{1000};
+    double client_burst{100};
+    /**
+     * answer a shed request with an Overload packet, so that the client
+     * backs off rather than waiting for a timeout.
+     */
+    bool reply_overload{true};
+};
+
+/**
+ * @brief knobs shared by the servers in zeno::net
+ */
+struct ServerOptions
+{
+    /**
+     * max number of datagrams drained by one recvmmsg and answered by one
+     * sendmmsg. 1 keeps the classic one-datagram-per-syscall path.
+     */
+    size_t batch_size{1};
+    /**
+     * bind with SO_REUSEPORT so that several servers can share one port.
+     */
+    bool reuse_port{false};
+    /**
+     * the I/O engine. batch_size does not apply to Backend::IoUring, which
+     * already reaps every completion available per io_uring_enter.
+     */
+    Backend backend{Backend::Asio};
+    /**
+     * Backend::Asio only: receive with UDP_GRO, which coalesces the datagrams
+     * of a flow into super-packets of up to 64 KiB, and echo them with
+     * UDP_SEGMENT (GSO). Pays off for bulk transfers of multi-KB messages.
+     */
+    bool segmentation_offload{false};
+    /**
+     * seconds without any packet after which a client is evicted.
+     * 0 keeps clients until they send a Leave.
+     */
+    uint64_t idle_timeout{60};
+    /**
+     * Backend::BusyPoll only: SO_BUSY_POLL in microseconds, 0 to leave the
+     * socket default. Values above net.core.busy_read need CAP_NET_ADMIN.
+     */
+    int busy_poll_us{0};
+    /**
+     * Backend::BusyPoll only: SO_PREFER_BUSY_POLL, keeping the NIC
+     * interrupts masked while the application polls. Linux 5.11+.
+     */
+    bool prefer_busy_poll{false};
+    /**
+     * Backend::BusyPoll only: the CPU the polling thread is pinned to, -1
+     * for none.
+     */
+    int cpu{-1};
+    /**
+     * Backend::Asio and MultithreadServer: break the latency of one request
+     * in timestamp_sample down by stage, with software SO_TIMESTAMPING.
+     * 0 disables.
+     */
+    uint32_t timestamp_sample{0};
+    /**
+     * Backend::Asio and Backend::Busy: drop the datagrams whose CRC32C
+     * checksum does not match. Packets without a checksum are always
+     * accepted.
+     */
+    bool verify_checksum{false};
+    /**
+     * MultithreadServer only: bounds the requests queued to the workers.
+     */
+    AdmissionOptions admission;
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
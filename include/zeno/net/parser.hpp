@@ -1,7 +1,13 @@
 #ifndef PARSER_H_
 #define PARSER_H_
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
 
+#include <cstddef>
+
+#include "zeno/crc32c.hpp"
 #include "zeno/net/header.hpp"
 namespace zeno
 {
@@ -27,6 +33,268 @@ inline char *ParsePacketBody(char *data)
 {
     return data + sizeof(PacketHeader);
 }
+
+inline Checksum ParseChecksum(const char *data)
+{
+    auto *header = (PacketHeader *) data;
+    return header->checksum;
+}
+
+/**
+ * @return the checksum of the packet of @p length bytes at @p data: the
+ * CRC32C of all its bytes but the checksum field. A CRC of 0 is sent as
+ * ~0, as 0 means no checksum.
+ */
+inline Checksum ComputeChecksum(const char *data, size_t length)
+{
+    constexpr size_t kBefore = offsetof(PacketHeader, checksum);
+    constexpr size_t kAfter = kBefore + sizeof(Checksum);
+    uint32_t crc = Crc32c(data + kAfter, length - kAfter, Crc32c(data, kBefore));
+    return crc != 0 ? crc : ~(Checksum) 0;
+}
+
+/**
+ * @brief fill in the checksum of a complete packet, to be done last
+ */
+inline void SealPacket(char *data, size_t length)
+{
+    ((PacketHeader *) data)->checksum = ComputeChecksum(data, length);
+}
+
+/**
+ * @return whether the packet of @p length bytes at @p data, at least a
+ * header, has no checksum or the right one
+ */
+inline bool VerifyPacket(const char *data, size_t length)
+{
+    Checksum checksum = ParseChecksum(data);
+    return checksum == 0 || checksum == ComputeChecksum(data, length);
+}
+
+/**
+ * @brief whether ZENO_CHECKSUM asks to seal and verify packets
+ */
+inline bool ChecksumFromEnv(const char *name = "ZENO_CHECKSUM")
+{
+    const char *spec = getenv(name);
+    return spec != nullptr && strcmp(spec, "0") != 0;
+}
+
+/**
+ * @brief VerifyPacket() on @p n packets at once, setting @p ok[i] for each
+ *
+ * The CRCs of the checksummed packets are computed side by side, see
+ * Crc32cBatch(), which pays off on the short datagrams of a receive batch.
+ * Packets shorter than a header fail.
+ *
+ * @return the number of packets failing
+ */
+inline size_t VerifyPackets(const char *const *packets,
+                            const size_t *lengths,
+                            size_t n,
+                            bool *ok)
+{
+    constexpr size_t kBefore = offsetof(PacketHeader, checksum);
+    constexpr size_t kAfter = kBefore + sizeof(Checksum);
+    constexpr size_t kChunk = 64;
+    const char *data[kChunk];
+    size_t rest[kChunk];
+    uint32_t crcs[kChunk];
+    size_t index[kChunk];
+    size_t failed = 0;
+    for (size_t first = 0; first < n; first += kChunk)
+    {
+        size_t last = first + kChunk < n ? first + kChunk : n;
+        size_t nr = 0;
+        for (size_t i = first; i < last; ++i)
+        {
+            if (lengths[i] < sizeof(PacketHeader))
+            {
+                ok[i] = false;
+                failed++;
+                continue;
+            }
+            ok[i] = ParseChecksum(packets[i]) == 0;
+            if (!ok[i])
+            {
+                data[nr] = packets[i] + kAfter;
+                rest[nr] = lengths[i] - kAfter;
+                crcs[nr] = Crc32c(packets[i], kBefore);
+                index[nr++] = i;
+            }
+        }
+        Crc32cBatch(crcs, data, rest, nr);
+        for (size_t k = 0; k < nr; ++k)
+        {
+            Checksum checksum = crcs[k] != 0 ? crcs[k] : ~(Checksum) 0;
+            ok[index[k]] = checksum == ParseChecksum(packets[index[k]]);
+            failed += ok[index[k]] ? 0 : 1;
+        }
+    }
+    return failed;
+}
+
+/**
+ * @brief one logical message inside a Frame packet
+ */
+struct MessageView
+{
+    const char *data;
+    size_t length;
+};
+
+/**
+ * @brief forward iterator over the messages of a Frame packet
+ *
+ * A message claiming more bytes than left in the datagram ends the
+ * iteration, so a truncated or malformed frame never reads out of bounds.
+ */
+class MessageIterator
+{
+public:
+    MessageIterator() = default;
+    MessageIterator(const char *pos, const char *end, size_t remain)
+        : pos_(pos), end_(end), remain_(remain)
+    {
+        load();
+    }
+
+    const MessageView &operator*() const
+    {
+        return current_;
+    }
+    const MessageView *operator->() const
+    {
+        return &current_;
+    }
+    MessageIterator &operator++()
+    {
+        pos_ = current_.data + current_.length;
+        remain_--;
+        load();
+        return *this;
+    }
+    bool operator==(const MessageIterator &rhs) const
+    {
+        return remain_ == rhs.remain_;
+    }
+    bool operator!=(const MessageIterator &rhs) const
+    {
+        return !(*this == rhs);
+    }
+
+private:
+    void load()
+    {
+        if (remain_ == 0)
+        {
+            return;
+        }
+        MessageLength length;
+        if ((size_t)(end_ - pos_) < sizeof(length))
+        {
+            remain_ = 0;
+            return;
+        }
+        memcpy(&length, pos_, sizeof(length));
+        const char *data = pos_ + sizeof(length);
+        if ((size_t)(end_ - data) < length)
+        {
+            remain_ = 0;
+            return;
+        }
+        current_.data = data;
+        current_.length = length;
+    }
+
+    const char *pos_{nullptr};
+    const char *end_{nullptr};
+    size_t remain_{0};
+    MessageView current_{nullptr, 0};
+};
+
+/**
+ * @brief the messages of a Frame packet, for use in a range-for
+ *
+ *   for (const auto &msg : ParseFrame(data, bytes_recvd)) { ... }
+ */
+class FrameView
+{
+public:
+    FrameView(const char *data, size_t length)
+    {
+        if (length < kFrameOverhead ||
+            ParsePacketType(data) != PacketType::Frame)
+        {
+            return;
+        }
+        FrameHeader frame;
+        memcpy(&frame, data + sizeof(PacketHeader), sizeof(frame));
+        message_nr_ = frame.message_nr;
+        begin_ = MessageIterator(
+            data + kFrameOverhead, data + length, message_nr_);
+    }
+
+    /**
+     * @brief the number of messages the frame claims to carry
+     */
+    size_t message_nr() const
+    {
+        return message_nr_;
+    }
+    MessageIterator begin() const
+    {
+        return begin_;
+    }
+    MessageIterator end() const
+    {
+        return MessageIterator();
+    }
+
+private:
+    size_t message_nr_{0};
+    MessageIterator begin_;
+};
+
+inline FrameView ParseFrame(const char *data, size_t length)
+{
+    return FrameView(data, length);
+}
+
+/**
+ * @brief split a byte stream into packets, framed by their packet_length
+ *
+ * Calls @p on_packet(data, length) in place for every complete packet at the
+ * front of [data, data + length). A trailing partial packet is left for the
+ * next call.
+ *
+ * @return the bytes of the complete packets, or -1 if a header claims less
+ * than a header or more than @p max_packet bytes, after which the stream
+ * cannot be resynchronized.
+ */
+template <typename F>
+inline ssize_t ParseStream(char *data,
+                           size_t length,
+                           size_t max_packet,
+                           F &&on_packet)
+{
+    size_t pos = 0;
+    while (length - pos >= sizeof(PacketHeader))
+    {
+        PacketLength packet_length = ParsePacketLength(data + pos);
+        if (packet_length < sizeof(PacketHeader) || packet_length > max_packet)
+        {
+            return -1;
+        }
+        if (length - pos < packet_length)
+        {
+            break;
+        }
+        on_packet(data + pos, (size_t) packet_length);
+        pos += packet_length;
+    }
+    return pos;
+}
 }  // namespace net
 }  // namespace zeno
 
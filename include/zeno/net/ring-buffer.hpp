@@ -0,0 +1,120 @@
+#ifndef NET_RING_BUFFER_H_
+#define NET_RING_BUFFER_H_
+
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstddef>
+
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief a byte ring whose storage is mapped twice, back to back
+ *
+ * Byte capacity() + i aliases byte i, so the readable and the writable
+ * regions are always contiguous, even when they wrap around the end. A
+ * stream parser can thus point straight into the ring at a packet that
+ * straddles the end, with no copy and no special case.
+ *
+ * The capacity is rounded up to a multiple of the page size. Offsets are
+ * free-running, so full and empty need no extra flag.
+ */
+class RingBuffer
+{
+public:
+    explicit RingBuffer(size_t capacity)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        capacity_ = (capacity + page - 1) / page * page;
+
+        int fd = syscall(SYS_memfd_create, "zeno-ring", 0);
+        check(fd >= 0, "memfd_create failed: %s", strerror(errno));
+        check(ftruncate(fd, capacity_) == 0,
+              "ftruncate failed: %s",
+              strerror(errno));
+
+        // reserve twice the space, then map the same file over both halves.
+        void *base = mmap(nullptr,
+                          2 * capacity_,
+                          PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1,
+                          0);
+        check(base != MAP_FAILED, "mmap failed: %s", strerror(errno));
+        base_ = (char *) base;
+        for (int half = 0; half < 2; ++half)
+        {
+            void *view = mmap(base_ + half * capacity_,
+                              capacity_,
+                              PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_FIXED,
+                              fd,
+                              0);
+            check(view == base_ + half * capacity_,
+                  "mmap failed: %s",
+                  strerror(errno));
+        }
+        close(fd);
+    }
+    ~RingBuffer()
+    {
+        munmap(base_, 2 * capacity_);
+    }
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    /**
+     * @brief the bytes written and not consumed yet
+     */
+    char *read_ptr() const
+    {
+        return base_ + (head_ % capacity_);
+    }
+    size_t readable() const
+    {
+        return tail_ - head_;
+    }
+    void consume(size_t n)
+    {
+        dcheck(n <= readable());
+        head_ += n;
+    }
+
+    /**
+     * @brief the free space, where the next bytes go
+     */
+    char *write_ptr() const
+    {
+        return base_ + (tail_ % capacity_);
+    }
+    size_t writable() const
+    {
+        return capacity_ - readable();
+    }
+    void commit(size_t n)
+    {
+        dcheck(n <= writable());
+        tail_ += n;
+    }
+
+private:
+    char *base_{nullptr};
+    size_t capacity_{0};
+    size_t head_{0};
+    size_t tail_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -1,14 +1,25 @@
 #ifndef NET_SERVER_H_
 #define NET_SERVER_H_
 
+#include <errno.h>
+#include <string.h>
+
 #include <boost/asio.hpp>
 #include <boost/asio/deadline_timer.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/udp.hpp>
-#include <unordered_map>
+#include <memory>
+#include <vector>
 
+#include "zeno/cpu.hpp"
 #include "zeno/debug.hpp"
+#include "zeno/net/client-registry.hpp"
+#include "zeno/net/handler.hpp"
+#include "zeno/net/mmsg.hpp"
+#include "zeno/net/options.hpp"
 #include "zeno/net/parser.hpp"
+#include "zeno/net/socket-option.hpp"
+#include "zeno/net/timestamps.hpp"
 
 namespace zeno
 {
@@ -16,18 +27,75 @@ namespace net
 {
 using boost::asio::ip::udp;
 
-class server
+/**
+ * @brief a single-threaded UDP server answering each datagram with @p Handler
+ *
+ * See handler.hpp for the handler contract, and zeno::net::server for the
+ * echo server.
+ *
+ * With ServerOptions::timestamp_sample, the sampled requests are broken
+ * down by Stage. The batched path reads the kernel RX and TX timestamps
+ * with the datagrams and from the error queue. The classic path only has
+ * the RX timestamp of the last datagram, with SIOCGSTAMPNS.
+ *
+ * With ServerOptions::verify_checksum, datagrams with a wrong checksum are
+ * dropped before the handler. The batched path verifies a whole receive
+ * batch at once, see VerifyPackets().
+ */
+template <typename Handler = EchoHandler>
+class basic_server
 {
 public:
-    server(boost::asio::io_context &io_context, short port)
-        : socket_(io_context, udp::endpoint(udp::v4(), port)),
-          deadline_(io_context)
+    basic_server(boost::asio::io_context &io_context,
+                 short port,
+                 const ServerOptions &options = ServerOptions(),
+                 Handler handler = Handler())
+        : socket_(io_context),
+          clients_(options.idle_timeout),
+          handler_(handler),
+          deadline_(io_context),
+          batch_(options.batch_size,
+                 options.segmentation_offload ? MsgBatch::kMaxSuperPacket
+                                              : (size_t) max_length,
+                 options.segmentation_offload,
+                 options.timestamp_sample != 0),
+          breakdown_(options.timestamp_sample),
+          verify_checksum_(options.verify_checksum)
     {
+        socket_.open(udp::v4());
+        if (options.reuse_port)
+        {
+            socket_.set_option(option::reuse_port(true));
+        }
+        socket_.bind(udp::endpoint(udp::v4(), port));
+
         info("Server is listening on 0.0.0.0:%d", port);
         deadline_.expires_from_now(boost::posix_time::seconds(1));
 
         check_timeout();
-        do_receive();
+        info_if(verify_checksum_,
+                "CRC32C checksums verified, %s",
+                Crc32cAccelerated() ? "with SSE4.2" : "in software");
+        if (options.segmentation_offload)
+        {
+            info("UDP GRO/GSO enabled");
+            EnableGro(socket_.native_handle());
+        }
+        if (options.batch_size > 1 || options.segmentation_offload)
+        {
+            info("Batched I/O enabled, up to %lu datagrams per syscall",
+                 options.batch_size);
+            if (breakdown_.enabled())
+            {
+                EnableTimestamping(socket_.native_handle());
+            }
+            socket_.non_blocking(true);
+            do_wait();
+        }
+        else
+        {
+            do_receive();
+        }
     }
 
     void check_timeout()
@@ -36,6 +104,12 @@ public:
             boost::asio::deadline_timer::traits_type::now())
         {
             dinfo("Heartbeat one second.");
+            clients_.tick();
+            clients_.report();
+            report_batch();
+            meter_.report("UDP per core");
+            report_breakdown();
+            report_checksum();
             deadline_.expires_from_now(boost::posix_time::seconds(1));
         }
         deadline_.async_wait([&](boost::system::error_code ec) {
@@ -56,26 +130,38 @@ public:
             boost::asio::buffer(data_, max_length),
             sender_endpoint_,
             [this](boost::system::error_code ec, std::size_t bytes_recvd) {
-                if (!ec && bytes_recvd > 0)
+                if (!ec && bytes_recvd >= sizeof(PacketHeader) &&
+                    verified(data_, bytes_recvd))
                 {
                     dinfo("server recv msg with size = %lu", bytes_recvd);
 
-                    auto client_id = zeno::net::ParseClientId(data_);
-                    if (endpoint_map_.find(client_id) == endpoint_map_.end())
+                    clients_.on_packet(zeno::net::ParseClientId(data_),
+                                       zeno::net::ParsePacketType(data_),
+                                       sender_endpoint_.data(),
+                                       sender_endpoint_.size());
+                    meter_.add(1, bytes_recvd);
+                    uint64_t start = 0;
+                    if (breakdown_.sample())
                     {
-                        info("Permanently add (%" PRIu64
-                             ", %s:%d) into known clients",
-                             client_id,
-                             sender_endpoint_.address().to_string().c_str(),
-                             sender_endpoint_.port());
-                        endpoint_map_[client_id] = sender_endpoint_;
+                        start = RealtimeNs();
+                        breakdown_.record(Stage::KernelRx,
+                                          LastRxTimestamp(
+                                              socket_.native_handle()),
+                                          start);
+                    }
+                    size_t response = handler_(data_, bytes_recvd);
+                    if (start != 0)
+                    {
+                        handled_ns_ = RealtimeNs();
+                        breakdown_.record(Stage::Handler, start, handled_ns_);
+                    }
+                    if (response != 0)
+                    {
+                        do_send(response);
+                        return;
                     }
-                    do_send(bytes_recvd);
-                }
-                else
-                {
-                    do_receive();
                 }
+                do_receive();
             });
     }
 
@@ -85,13 +171,353 @@ public:
             boost::asio::buffer(data_, length),
             sender_endpoint_,
             [this](boost::system::error_code /*ec*/,
-                   std::size_t /*bytes_sent*/) { do_receive(); });
+                   std::size_t /*bytes_sent*/) {
+                if (handled_ns_ != 0)
+                {
+                    breakdown_.record(Stage::Send, handled_ns_, RealtimeNs());
+                    handled_ns_ = 0;
+                }
+                do_receive();
+            });
+    }
+
+    /**
+     * @brief wait for the socket to become readable, then drain it.
+     *
+     * Used by the batched path: the reactor only tells us there is something
+     * to read, and do_drain() pulls it out with as few syscalls as possible.
+     */
+    void do_wait()
+    {
+        socket_.async_wait(udp::socket::wait_read,
+                           [this](boost::system::error_code ec) {
+                               if (ec)
+                               {
+                                   error("wait_read get errno: %d", ec.value());
+                                   return;
+                               }
+                               do_drain();
+                               do_wait();
+                           });
+    }
+
+    /**
+     * @brief recvmmsg until EAGAIN, answering each batch with one sendmmsg
+     *
+     * With segmentation offload a slot may hold a GRO super-packet: it is
+     * split back into its datagrams, see handle_slot().
+     */
+    void do_drain()
+    {
+        int fd = socket_.native_handle();
+        if (breakdown_.enabled())
+        {
+            drain_tx_timestamps(fd);
+        }
+        while (true)
+        {
+            int nr = batch_.recv(fd);
+            if (nr < 0)
+            {
+                error_if(errno != EAGAIN && errno != EWOULDBLOCK,
+                         "recvmmsg failed: %s",
+                         strerror(errno));
+                return;
+            }
+            recv_syscalls_++;
+            recv_datagrams_ += nr;
+            uint64_t dequeued = breakdown_.enabled() ? RealtimeNs() : 0;
+            if (verify_checksum_)
+            {
+                verify_batch(nr);
+            }
+
+            for (int i = 0; i < nr; ++i)
+            {
+                handle_slot(fd, i, dequeued);
+            }
+            send_responses(fd, nr);
+
+            if ((size_t) nr < batch_.capacity())
+            {
+                return;
+            }
+        }
     }
 
 private:
+    /**
+     * @brief handle every datagram of slot @p i, packing their responses at
+     * the front of the slot
+     *
+     * The responses of a GRO super-packet go back whole, with UDP_SEGMENT,
+     * as long as the kernel can split them: all of the same size but the
+     * last, which may be shorter. An echo always qualifies. Otherwise they
+     * are sent one by one.
+     *
+     * @p dequeued is when the slot was received, 0 unless timestamping.
+     */
+    void handle_slot(int fd, size_t i, uint64_t dequeued)
+    {
+        uint64_t start = 0;
+        if (dequeued != 0 && breakdown_.sample())
+        {
+            start = RealtimeNs();
+            breakdown_.record(Stage::KernelRx, batch_.rx_timestamp(i), dequeued);
+            breakdown_.record(Stage::Queue, dequeued, start);
+        }
+        char *slot = batch_.data(i);
+        size_t packed = 0;
+        bool uniform = true;
+        responses_.clear();
+        size_t segments = ForEachSegment(
+            slot,
+            batch_.length(i),
+            batch_.segment_size(i),
+            [&](char *data, size_t length) {
+                bool verified = !verify_checksum_ || verified_[verify_index_++];
+                if (unlikely(length < sizeof(PacketHeader)))
+                {
+                    return;
+                }
+                if (unlikely(!verified))
+                {
+                    corrupt_++;
+                    return;
+                }
+                clients_.on_packet(ParseClientId(data),
+                                   ParsePacketType(data),
+                                   batch_.name(i),
+                                   batch_.namelen(i));
+                size_t response = handler_(data, length);
+                if (response == 0)
+                {
+                    return;
+                }
+                uniform = uniform &&
+                          (responses_.empty() ||
+                           (responses_.back() == responses_.front() &&
+                            response <= responses_.front()));
+                // responses never outgrow their request, so packing only
+                // moves bytes backwards.
+                memmove(slot + packed, data, response);
+                packed += response;
+                responses_.push_back(response);
+            });
+        recv_segments_ += segments;
+        meter_.add(segments, batch_.length(i));
+        uint64_t handled = 0;
+        if (start != 0)
+        {
+            handled = RealtimeNs();
+            breakdown_.record(Stage::Handler, start, handled);
+        }
+
+        if (!uniform)
+        {
+            size_t pos = 0;
+            for (size_t response : responses_)
+            {
+                if (::sendto(fd,
+                             slot + pos,
+                             response,
+                             MSG_DONTWAIT,
+                             batch_.name(i),
+                             batch_.namelen(i)) < 0)
+                {
+                    send_dropped_++;
+                }
+                pos += response;
+            }
+            packed = 0;
+        }
+        batch_.set_length(i, packed);
+        if (batch_.offload())
+        {
+            batch_.set_segment_size(i, uniform && !responses_.empty()
+                                           ? responses_.front()
+                                           : 0);
+        }
+        // only a slot left for sendmmsg carries the SO_TIMESTAMPING cmsg:
+        // the responses sent one by one above never get stamped.
+        if (handled != 0 && uniform && packed != 0)
+        {
+            sampled_.push_back(handled);
+            // one TX timestamp in flight at a time, so that it needs no id.
+            if (tx_requested_ns_ == 0)
+            {
+                batch_.request_tx_timestamp(i);
+                tx_requested_ns_ = handled;
+                tx_slot_ = i;
+            }
+        }
+    }
+
+    /**
+     * @brief sendmmsg the first @p nr slots, skipping those left empty
+     *
+     * The reply goes back to msg_name. Slots are sent in runs of non-empty
+     * ones, so an echo still takes a single sendmmsg.
+     */
+    void send_responses(int fd, size_t nr)
+    {
+        if (tx_requested_ns_ != 0 && tx_sent_ns_ == 0)
+        {
+            tx_sent_ns_ = RealtimeNs();
+        }
+        size_t first = 0;
+        while (first < nr)
+        {
+            if (batch_.length(first) == 0)
+            {
+                first++;
+                continue;
+            }
+            size_t end = first;
+            while (end < nr && batch_.length(end) != 0)
+            {
+                end++;
+            }
+            while (first < end)
+            {
+                int ret = batch_.send(fd, first, end - first);
+                if (ret < 0)
+                {
+                    error_if(errno != EAGAIN && errno != EWOULDBLOCK,
+                             "sendmmsg failed: %s",
+                             strerror(errno));
+                    send_dropped_ += end - first;
+                    if (tx_slot_ >= first && tx_slot_ < end)
+                    {
+                        // dropped: its timestamp will never come.
+                        tx_requested_ns_ = 0;
+                        tx_sent_ns_ = 0;
+                    }
+                    break;
+                }
+                send_syscalls_++;
+                first += ret;
+            }
+            first = end;
+        }
+        tx_slot_ = ~0ul;
+        if (!sampled_.empty())
+        {
+            uint64_t now = RealtimeNs();
+            for (uint64_t handled : sampled_)
+            {
+                breakdown_.record(Stage::Send, handled, now);
+            }
+            sampled_.clear();
+        }
+    }
+
+    /**
+     * @brief verify the checksums of every datagram of the first @p nr
+     * slots at once, for handle_slot() to look up in order
+     */
+    void verify_batch(size_t nr)
+    {
+        verify_packets_.clear();
+        verify_lengths_.clear();
+        for (size_t i = 0; i < nr; ++i)
+        {
+            ForEachSegment(batch_.data(i),
+                           batch_.length(i),
+                           batch_.segment_size(i),
+                           [this](char *data, size_t length) {
+                               verify_packets_.push_back(data);
+                               verify_lengths_.push_back(length);
+                           });
+        }
+        size_t n = verify_packets_.size();
+        if (verified_capacity_ < n)
+        {
+            verified_.reset(new bool[n]);
+            verified_capacity_ = n;
+        }
+        VerifyPackets(
+            verify_packets_.data(), verify_lengths_.data(), n, verified_.get());
+        verify_index_ = 0;
+    }
+
+    /**
+     * @brief the classic path's verification of one datagram
+     */
+    bool verified(const char *data, size_t length)
+    {
+        if (!verify_checksum_ || VerifyPacket(data, length))
+        {
+            return true;
+        }
+        corrupt_++;
+        return false;
+    }
+
+    void report_checksum()
+    {
+        warn_if(corrupt_ != 0,
+                "Dropped %" PRIu64 " datagrams with a bad checksum",
+                corrupt_);
+        corrupt_ = 0;
+    }
+
+    void drain_tx_timestamps(int fd)
+    {
+        DrainTxTimestamps(fd, [this](uint64_t ns) {
+            breakdown_.record(Stage::KernelTx, tx_sent_ns_, ns);
+            tx_requested_ns_ = 0;
+            tx_sent_ns_ = 0;
+        });
+    }
+
+    void report_breakdown()
+    {
+        if (!breakdown_.enabled())
+        {
+            return;
+        }
+        breakdown_.report();
+        // a TX timestamp may never come, e.g. if the send failed.
+        if (tx_requested_ns_ != 0 &&
+            RealtimeNs() - tx_requested_ns_ > 1000000000ull)
+        {
+            tx_requested_ns_ = 0;
+            tx_sent_ns_ = 0;
+        }
+    }
+
+    void report_batch()
+    {
+        if (recv_syscalls_ == 0)
+        {
+            return;
+        }
+        info("Batched I/O: %" PRIu64 " datagrams in %" PRIu64
+             " recvmmsg and %" PRIu64 " sendmmsg (%.2lf per recv), %" PRIu64
+             " replies dropped",
+             recv_datagrams_,
+             recv_syscalls_,
+             send_syscalls_,
+             1.0 * recv_datagrams_ / recv_syscalls_,
+             send_dropped_);
+        info_if(recv_segments_ != recv_datagrams_,
+                "UDP GRO: %" PRIu64 " datagrams in %" PRIu64
+                " super-packets (%.2lf per super-packet)",
+                recv_segments_,
+                recv_datagrams_,
+                1.0 * recv_segments_ / recv_datagrams_);
+        recv_segments_ = 0;
+        recv_datagrams_ = 0;
+        recv_syscalls_ = 0;
+        send_syscalls_ = 0;
+        send_dropped_ = 0;
+    }
+
     udp::socket socket_;
     udp::endpoint sender_endpoint_;
-    std::unordered_map<zeno::net::ClientId, udp::endpoint> endpoint_map_;
+    ClientRegistry clients_;
+    Handler handler_;
 
     boost::asio::deadline_timer deadline_;
     enum
@@ -99,7 +525,40 @@ private:
         max_length = 1024
     };
     char data_[max_length];
+
+    MsgBatch batch_;
+    // the response lengths of the slot being handled
+    std::vector<size_t> responses_;
+    uint64_t recv_datagrams_{0};
+    // datagrams once GRO super-packets are split, >= recv_datagrams_
+    uint64_t recv_segments_{0};
+    uint64_t recv_syscalls_{0};
+    uint64_t send_syscalls_{0};
+    uint64_t send_dropped_{0};
+    CpuMeter meter_;
+
+    LatencyBreakdown breakdown_;
+    // when the sampled request answered by the classic path was handled
+    uint64_t handled_ns_{0};
+    // when the sampled slots of the batch being sent were handled
+    std::vector<uint64_t> sampled_;
+    // the TX timestamp in flight: when it was requested and sent
+    uint64_t tx_requested_ns_{0};
+    uint64_t tx_sent_ns_{0};
+    // the slot it was requested on, in the batch being sent
+    size_t tx_slot_{~0ul};
+
+    bool verify_checksum_;
+    // the datagrams of the batch being handled, and whether each passed
+    std::vector<const char *> verify_packets_;
+    std::vector<size_t> verify_lengths_;
+    std::unique_ptr<bool[]> verified_;
+    size_t verified_capacity_{0};
+    size_t verify_index_{0};
+    uint64_t corrupt_{0};
 };
+
+using server = basic_server<>;
 }  // namespace net
 }  // namespace zeno
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,255 @@
+#ifndef NET_SESSION_POOL_H_
+#define NET_SESSION_POOL_H_
+
+#include <inttypes.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "zeno/common.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief counters of one or all the thread-local pools of a type
+ */
+struct PoolStats
+{
+    // blocks obtained from the allocator
+    uint64_t mallocs{0};
+    // blocks returned to the allocator, because the caches were full
+    uint64_t frees{0};
+    // acquire() served from a freelist without touching the allocator
+    uint64_t reuses{0};
+    // blocks currently cached in the freelists and the depot
+    uint64_t cached{0};
+};
+
+/**
+ * @brief a per-thread freelist of storage for T
+ *
+ * acquire() constructs a T in a cached block, release() destroys it and
+ * caches the block in the pool of the *calling* thread. An object can thus
+ * be acquired on one thread and released on another without any locking on
+ * the fast path.
+ *
+ * Since blocks migrate from the threads that release to the threads that
+ * acquire, a thread whose freelist grows past 2 * kBatch hands kBatch blocks
+ * to a shared depot, and a thread whose freelist runs dry refills from it
+ * before calling the allocator. The depot lock is taken once per kBatch
+ * objects, and in steady state every acquire() is served from a freelist.
+ *
+ * Each thread gets its pool through local(). The pools register themselves
+ * so that stats() can aggregate the counters of every thread.
+ */
+template <typename T>
+class ObjectPool
+{
+public:
+    static constexpr size_t kBatch = 64;
+    static constexpr size_t kMaxDepotBatches = 1024;
+
+    ObjectPool()
+    {
+        std::lock_guard<std::mutex> lk(registry_mutex());
+        registry().push_back(this);
+    }
+    ~ObjectPool()
+    {
+        while (head_ != nullptr)
+        {
+            Node *next = head_->next;
+            delete head_;
+            head_ = next;
+            bump(frees_);
+        }
+        cached_.store(0, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lk(registry_mutex());
+        auto &pools = registry();
+        for (size_t i = 0; i < pools.size(); ++i)
+        {
+            if (pools[i] == this)
+            {
+                pools[i] = pools.back();
+                pools.pop_back();
+                break;
+            }
+        }
+        auto &r = retired();
+        r.mallocs += mallocs_.load(std::memory_order_relaxed);
+        r.frees += frees_.load(std::memory_order_relaxed);
+        r.reuses += reuses_.load(std::memory_order_relaxed);
+    }
+    ObjectPool(const ObjectPool &) = delete;
+    ObjectPool &operator=(const ObjectPool &) = delete;
+
+    static ObjectPool &local()
+    {
+        static thread_local ObjectPool pool;
+        return pool;
+    }
+
+    template <typename... Args>
+    T *acquire(Args &&... args)
+    {
+        if (unlikely(head_ == nullptr))
+        {
+            refill();
+        }
+        Node *node = head_;
+        if (likely(node != nullptr))
+        {
+            head_ = node->next;
+            cached_.store(cached_.load(std::memory_order_relaxed) - 1,
+                          std::memory_order_relaxed);
+            bump(reuses_);
+        }
+        else
+        {
+            node = new Node;
+            bump(mallocs_);
+        }
+        return new (&node->storage) T(std::forward<Args>(args)...);
+    }
+
+    void release(T *obj)
+    {
+        obj->~T();
+        Node *node = reinterpret_cast<Node *>(obj);
+        node->next = head_;
+        head_ = node;
+        cached_.store(cached_.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+        if (unlikely(cached_.load(std::memory_order_relaxed) >= 2 * kBatch))
+        {
+            spill();
+        }
+    }
+
+    /**
+     * @brief the counters summed over every thread, alive or exited
+     */
+    static PoolStats stats()
+    {
+        std::lock_guard<std::mutex> lk(registry_mutex());
+        PoolStats ret = retired();
+        for (auto *pool : registry())
+        {
+            ret.mallocs += pool->mallocs_.load(std::memory_order_relaxed);
+            ret.frees += pool->frees_.load(std::memory_order_relaxed);
+            ret.reuses += pool->reuses_.load(std::memory_order_relaxed);
+            ret.cached += pool->cached_.load(std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> depot_lk(depot_mutex());
+            ret.cached += depot().size() * kBatch;
+        }
+        return ret;
+    }
+
+private:
+    union Node
+    {
+        Node *next;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    /**
+     * @brief move kBatch blocks from the freelist to the depot
+     */
+    void spill()
+    {
+        Node *first = head_;
+        Node *last = head_;
+        for (size_t i = 1; i < kBatch; ++i)
+        {
+            last = last->next;
+        }
+        head_ = last->next;
+        last->next = nullptr;
+        cached_.store(cached_.load(std::memory_order_relaxed) - kBatch,
+                      std::memory_order_relaxed);
+
+        {
+            std::lock_guard<std::mutex> lk(depot_mutex());
+            if (depot().size() < kMaxDepotBatches)
+            {
+                depot().push_back(first);
+                return;
+            }
+        }
+        while (first != nullptr)
+        {
+            Node *next = first->next;
+            delete first;
+            first = next;
+            bump(frees_);
+        }
+    }
+
+    /**
+     * @brief take one batch of kBatch blocks from the depot, if any
+     */
+    void refill()
+    {
+        std::lock_guard<std::mutex> lk(depot_mutex());
+        if (depot().empty())
+        {
+            return;
+        }
+        head_ = depot().back();
+        depot().pop_back();
+        cached_.store(cached_.load(std::memory_order_relaxed) + kBatch,
+                      std::memory_order_relaxed);
+    }
+
+    // counters are only written by the owner thread, so a plain load/store
+    // is enough and avoids a locked instruction on the hot path.
+    static void bump(std::atomic<uint64_t> &counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+    }
+
+    static std::mutex &registry_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+    static std::vector<ObjectPool *> &registry()
+    {
+        static std::vector<ObjectPool *> pools;
+        return pools;
+    }
+    static std::mutex &depot_mutex()
+    {
+        static std::mutex m;
+        return m;
+    }
+    static std::vector<Node *> &depot()
+    {
+        static std::vector<Node *> batches;
+        return batches;
+    }
+    static PoolStats &retired()
+    {
+        static PoolStats stats;
+        return stats;
+    }
+
+    Node *head_{nullptr};
+    std::atomic<uint64_t> mallocs_{0};
+    std::atomic<uint64_t> frees_{0};
+    std::atomic<uint64_t> reuses_{0};
+    std::atomic<uint64_t> cached_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
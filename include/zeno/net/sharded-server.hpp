@@ -0,0 +1,164 @@
+#ifndef NET_SHARDED_SERVER_H_
+#define NET_SHARDED_SERVER_H_
+
+#include <boost/asio/io_context.hpp>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/busy-poll-server.hpp"
+#include "zeno/net/options.hpp"
+#include "zeno/net/server.hpp"
+#include "zeno/net/uring-server.hpp"
+#include "zeno/placement.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief one server per thread, sharing the port through SO_REUSEPORT
+ *
+ * Each shard owns its io_context and its socket, and is only ever touched by
+ * its own thread. The kernel hashes every flow to one of the sockets, so
+ * there is no strand, no shared socket queue and no cross-thread handoff.
+ *
+ * With Backend::IoUring every shard is a UringServer instead, with its own
+ * ring. With Backend::BusyPoll every shard is a BusyPollServer; those are
+ * always pinned, compactly unless told otherwise.
+ *
+ * Shard i runs on the CPU @p placement gives to worker i. It is also built
+ * by a thread pinned there, so that its buffers are first touched, and thus
+ * allocated, on the NUMA node that serves it.
+ */
+class ShardedServer
+{
+public:
+    ShardedServer(short port,
+                  size_t shard_nr,
+                  ServerOptions options,
+                  const Placement &placement = Placement())
+        : placement_(placement)
+    {
+        check(shard_nr > 0, "shard_nr should be positive");
+        options.reuse_port = true;
+        if (options.backend == Backend::BusyPoll &&
+            placement_.policy() == Placement::Policy::None)
+        {
+            placement_ = Placement::Parse("compact");
+        }
+        for (size_t i = 0; i < shard_nr; ++i)
+        {
+            if (placement_.policy() == Placement::Policy::None)
+            {
+                add_shard(port, options);
+                continue;
+            }
+            std::thread([&, i]() {
+                placement_.pin(i);
+                add_shard(port, options);
+            }).join();
+        }
+        info("Sharded server runs %lu shards on port %d", shard_nr, port);
+    }
+
+    size_t shard_nr() const
+    {
+        return servers_.size() + uring_servers_.size() + busy_servers_.size();
+    }
+
+    /**
+     * @brief run every shard on its own thread and wait for them to finish
+     */
+    void run()
+    {
+        std::vector<std::thread> threads;
+        for (auto &io_context : io_contexts_)
+        {
+            auto *ctx = io_context.get();
+            start(threads, [ctx]() { ctx->run(); });
+        }
+        for (auto &s : uring_servers_)
+        {
+            auto *srv = s.get();
+            start(threads, [srv]() { srv->run(); });
+        }
+        for (auto &s : busy_servers_)
+        {
+            auto *srv = s.get();
+            start(threads, [srv]() { srv->run(); });
+        }
+        for (auto &t : threads)
+        {
+            t.join();
+        }
+    }
+
+    void stop()
+    {
+        for (auto &io_context : io_contexts_)
+        {
+            io_context->stop();
+        }
+        for (auto &s : uring_servers_)
+        {
+            s->stop();
+        }
+        for (auto &s : busy_servers_)
+        {
+            s->stop();
+        }
+    }
+
+private:
+    void add_shard(short port, const ServerOptions &options)
+    {
+        if (options.backend == Backend::IoUring)
+        {
+            uring_servers_.emplace_back(new UringServer(port, options));
+        }
+        else if (options.backend == Backend::BusyPoll)
+        {
+            busy_servers_.emplace_back(new BusyPollServer(port, options));
+        }
+        else
+        {
+            io_contexts_.emplace_back(new boost::asio::io_context(1));
+            servers_.emplace_back(
+                new server(*io_contexts_.back(), port, options));
+        }
+    }
+
+    /**
+     * @brief run @p f on a new thread, pinned as the next shard
+     */
+    template <typename F>
+    void start(std::vector<std::thread> &threads, F f)
+    {
+        size_t i = threads.size();
+        const Placement &placement = placement_;
+        threads.emplace_back([i, f, &placement]() {
+            if (placement.pin(i))
+            {
+                info("Shard %lu runs on CPU %d, node %d",
+                     i,
+                     placement.cpu_of(i),
+                     placement.node_of(i));
+            }
+            f();
+        });
+    }
+
+    Placement placement_;
+    // servers_ are declared after io_contexts_ so that they are destroyed
+    // before the contexts their sockets live on.
+    std::vector<std::unique_ptr<boost::asio::io_context>> io_contexts_;
+    std::vector<std::unique_ptr<server>> servers_;
+    std::vector<std::unique_ptr<UringServer>> uring_servers_;
+    std::vector<std::unique_ptr<BusyPollServer>> busy_servers_;
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
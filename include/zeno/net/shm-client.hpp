@@ -0,0 +1,132 @@
+#ifndef NET_SHM_CLIENT_H_
+#define NET_SHM_CLIENT_H_
+
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "zeno/debug.hpp"
+#include "zeno/define.hpp"
+#include "zeno/net/header.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/net/shm-ring.hpp"
+#include "zeno/net/shm-server.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief the client side of ShmServer
+ *
+ * send() copies packets into the request ring, flush() hands them to the
+ * server at once, and receive() waits for responses, spinning before
+ * sleeping like the server. One ShmClient per thread.
+ */
+class ShmClient
+{
+public:
+    static constexpr uint64_t kSleepNs = 100 * 1000 * 1000;
+
+    ShmClient(short port, ClientId client_id, size_t capacity = define::MiB)
+        : segment_(capacity)
+    {
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        check(fd_ >= 0, "failed to create socket: %s", strerror(errno));
+        sockaddr_un addr;
+        socklen_t len = shm::SocketAddress(port, &addr);
+        check(connect(fd_, (sockaddr *) &addr, len) == 0,
+              "failed to connect to @%s: %s",
+              shm::SocketName(port).c_str(),
+              strerror(errno));
+
+        int memfd = segment_.fd();
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+        iovec iov;
+        iov.iov_base = &client_id;
+        iov.iov_len = sizeof(client_id);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &memfd, sizeof(memfd));
+        check(sendmsg(fd_, &msg, 0) == sizeof(client_id),
+              "failed to send the shm segment: %s",
+              strerror(errno));
+    }
+    ~ShmClient()
+    {
+        close(fd_);
+    }
+    ShmClient(const ShmClient &) = delete;
+    ShmClient &operator=(const ShmClient &) = delete;
+
+    /**
+     * @brief queue one packet, waiting for room if the server lags behind
+     */
+    void send(const char *packet, size_t length)
+    {
+        shm::Ring &requests = segment_.request();
+        char *out;
+        while ((out = requests.reserve(length)) == nullptr)
+        {
+            requests.wait_writable(waiter_, length, kSleepNs);
+        }
+        memcpy(out, packet, length);
+        requests.commit(length);
+    }
+    /**
+     * @brief hand the queued packets to the server
+     */
+    void flush()
+    {
+        segment_.request().publish();
+    }
+
+    /**
+     * @brief wait for responses, then call @p f(data, length) on each
+     *
+     * @return the number of responses
+     */
+    template <typename F>
+    size_t receive(F &&f)
+    {
+        shm::Ring &responses = segment_.response();
+        while (true)
+        {
+            size_t readable = responses.readable();
+            size_t nr = 0;
+            ssize_t n = ParseStream(responses.read_ptr(),
+                                    readable,
+                                    responses.capacity(),
+                                    [&](char *data, size_t length) {
+                                        f(data, length);
+                                        nr++;
+                                    });
+            check(n >= 0, "malformed response from the shm server");
+            if (nr != 0)
+            {
+                responses.release(n);
+                return nr;
+            }
+            responses.wait_readable(waiter_, readable, kSleepNs);
+        }
+    }
+
+private:
+    int fd_{-1};
+    shm::Segment segment_;
+    shm::SpinWaiter waiter_;
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,471 @@
+#ifndef NET_SHM_RING_H_
+#define NET_SHM_RING_H_
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#include "zeno/common.hpp"
+#include "zeno/cpu.hpp"
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+namespace net
+{
+namespace shm
+{
+/**
+ * @brief block while *word == expected, at most @p timeout_ns. Works across
+ * processes, the word being in shared memory.
+ */
+inline void FutexWait(std::atomic<uint32_t> *word,
+                      uint32_t expected,
+                      uint64_t timeout_ns)
+{
+    timespec ts;
+    ts.tv_sec = timeout_ns / 1000000000ull;
+    ts.tv_nsec = timeout_ns % 1000000000ull;
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+inline void FutexWake(std::atomic<uint32_t> *word)
+{
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+/**
+ * @brief the shared state of one ring, at the start of the segment
+ *
+ * head and tail sit on their own cache lines, so that the producer and the
+ * consumer only ever share the line they hand over.
+ */
+struct RingControl
+{
+    // written by the producer
+    std::atomic<uint64_t> tail;
+    char padding0[56];
+    // written by the consumer
+    std::atomic<uint64_t> head;
+    char padding1[56];
+    // futex words, set by a side before it goes to sleep
+    std::atomic<uint32_t> consumer_sleeping;
+    std::atomic<uint32_t> producer_sleeping;
+    char padding2[56];
+};
+static_assert(sizeof(RingControl) == 192, "RingControl layout");
+
+/**
+ * @brief spin for a while, then sleep on a futex
+ *
+ * The spin budget adapts to the peer: it doubles whenever spinning paid off
+ * and halves whenever we had to sleep anyway, between kMinSpins and
+ * kMaxSpins. A busy peer is thus caught without a syscall, while an idle one
+ * costs little CPU.
+ */
+class SpinWaiter
+{
+public:
+    static constexpr uint32_t kMinSpins = 16;
+    static constexpr uint32_t kMaxSpins = 64 * 1024;
+
+    /**
+     * @brief wait until @p ready() or @p timeout_ns elapsed in sleep
+     *
+     * @p sleeping is the futex word of our side: the peer wakes it after
+     * making progress, if it sees it set.
+     *
+     * @return ready()
+     */
+    template <typename F>
+    bool wait(F &&ready, std::atomic<uint32_t> &sleeping, uint64_t timeout_ns)
+    {
+        for (uint32_t i = 0; i < spins_; ++i)
+        {
+            if (ready())
+            {
+                spins_ = spins_ * 2 < kMaxSpins ? spins_ * 2 : kMaxSpins;
+                spun_++;
+                return true;
+            }
+            CpuRelax();
+        }
+        spins_ = spins_ / 2 > kMinSpins ? spins_ / 2 : kMinSpins;
+        sleeping.store(1, std::memory_order_seq_cst);
+        // re-check after announcing the sleep, or a wakeup may be missed.
+        if (!ready())
+        {
+            slept_++;
+            FutexWait(&sleeping, 1, timeout_ns);
+        }
+        sleeping.store(0, std::memory_order_relaxed);
+        return ready();
+    }
+
+    uint64_t spun() const
+    {
+        return spun_;
+    }
+    uint64_t slept() const
+    {
+        return slept_;
+    }
+    void reset_stats()
+    {
+        spun_ = slept_ = 0;
+    }
+
+private:
+    uint32_t spins_{1024};
+    uint64_t spun_{0};
+    uint64_t slept_{0};
+};
+
+/**
+ * @brief wake the peer if it announced it went to sleep on @p sleeping
+ */
+inline void Notify(std::atomic<uint32_t> &sleeping)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (unlikely(sleeping.load(std::memory_order_relaxed)))
+    {
+        sleeping.store(0, std::memory_order_relaxed);
+        FutexWake(&sleeping);
+    }
+}
+
+/**
+ * @brief a single-producer single-consumer byte ring in shared memory
+ *
+ * The data area is mapped twice back to back like RingBuffer, so what is
+ * reserved or readable is always contiguous. Packets are written in place
+ * with their PacketHeader, and read back in place with ParseStream.
+ *
+ * Both sides batch: the producer commits many packets and publishes them at
+ * once, the consumer releases all it handled at once.
+ *
+ * A Ring is only a view: the memory belongs to a Segment.
+ */
+class Ring
+{
+public:
+    Ring() = default;
+    Ring(RingControl *control, char *data, size_t capacity)
+        : control_(control),
+          data_(data),
+          capacity_(capacity),
+          head_(control->head.load(std::memory_order_relaxed))
+    {
+    }
+
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+
+    // producer side
+
+    /**
+     * @return room for @p length bytes after the committed ones, or nullptr
+     * if the ring is too full
+     */
+    char *reserve(size_t length)
+    {
+        uint64_t tail = control_->tail.load(std::memory_order_relaxed) +
+                        committed_;
+        if (capacity_ - (tail - cached_head_) < length)
+        {
+            cached_head_ = control_->head.load(std::memory_order_acquire);
+            if (capacity_ - (tail - cached_head_) < length)
+            {
+                return nullptr;
+            }
+        }
+        return data_ + tail % capacity_;
+    }
+    /**
+     * @brief mark @p length reserved bytes as written. They stay invisible to
+     * the consumer until publish(), so a batch costs a single handover.
+     */
+    void commit(size_t length)
+    {
+        committed_ += length;
+    }
+    /**
+     * @brief make the committed bytes visible, waking the consumer if needed
+     */
+    void publish()
+    {
+        if (committed_ == 0)
+        {
+            return;
+        }
+        uint64_t tail = control_->tail.load(std::memory_order_relaxed);
+        control_->tail.store(tail + committed_, std::memory_order_release);
+        committed_ = 0;
+        Notify(control_->consumer_sleeping);
+    }
+    /**
+     * @brief publish, then wait until @p length bytes can be reserved
+     */
+    bool wait_writable(SpinWaiter &waiter, size_t length, uint64_t timeout_ns)
+    {
+        publish();
+        return waiter.wait([&]() { return reserve(length) != nullptr; },
+                           control_->producer_sleeping,
+                           timeout_ns);
+    }
+
+    // consumer side
+
+    char *read_ptr() const
+    {
+        return data_ + head_ % capacity_;
+    }
+    /**
+     * @brief the bytes published past the head, from one load of the tail.
+     * More than capacity() means the producer wrote a bogus tail.
+     */
+    size_t readable() const
+    {
+        return control_->tail.load(std::memory_order_acquire) - head_;
+    }
+    /**
+     * @brief give @p length read bytes back to the producer
+     */
+    void release(size_t length)
+    {
+        head_ += length;
+        control_->head.store(head_, std::memory_order_release);
+        Notify(control_->producer_sleeping);
+    }
+    /**
+     * @brief wait until more than @p seen bytes are readable
+     */
+    bool wait_readable(SpinWaiter &waiter, size_t seen, uint64_t timeout_ns)
+    {
+        return waiter.wait([&]() { return readable() > seen; },
+                           control_->consumer_sleeping,
+                           timeout_ns);
+    }
+
+private:
+    RingControl *control_{nullptr};
+    char *data_{nullptr};
+    size_t capacity_{0};
+    // the producer's last view of head, to avoid touching its cache line
+    uint64_t cached_head_{0};
+    uint64_t committed_{0};
+    // the consumer's own head: the peer may scribble on the shared one
+    uint64_t head_{0};
+};
+
+/**
+ * @brief the memfd shared by one client and the server: a request ring and
+ * a response ring
+ *
+ * Layout: one page of control (header, then the two RingControl), then the
+ * request data, then the response data, each capacity bytes.
+ */
+class Segment
+{
+public:
+    static constexpr uint64_t kMagic = 0x7a656e6f73686d31ull;  // "zenoshm1"
+
+    /**
+     * @brief create a new segment, on the client side
+     *
+     * Its size is sealed, so that the server can trust it stays mapped.
+     */
+    explicit Segment(size_t capacity)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        capacity_ = (capacity + page - 1) / page * page;
+        fd_ = syscall(SYS_memfd_create, "zeno-shm", MFD_ALLOW_SEALING);
+        check(fd_ >= 0, "memfd_create failed: %s", strerror(errno));
+        check(ftruncate(fd_, page + 2 * capacity_) == 0,
+              "ftruncate failed: %s",
+              strerror(errno));
+        check(fcntl(fd_, F_ADD_SEALS, kSeals | F_SEAL_SEAL) == 0,
+              "failed to seal the memfd: %s",
+              strerror(errno));
+        check(map(), "mmap failed: %s", strerror(errno));
+        header_->magic = kMagic;
+        header_->capacity = capacity_;
+    }
+    /**
+     * @brief map the segment of a client from the @p fd it sent, on the
+     * server side. Takes ownership of @p fd.
+     *
+     * The client is not trusted: the fd must be a memfd whose size is
+     * sealed and matches the capacity in its header.
+     *
+     * @return nullptr if the segment does not check out
+     */
+    static Segment *Open(int fd)
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        Header header;
+        struct stat st;
+        int seals = fcntl(fd, F_GET_SEALS);
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+            header.magic != kMagic || fstat(fd, &st) != 0 ||
+            !S_ISREG(st.st_mode) || seals < 0 || (seals & kSeals) != kSeals ||
+            header.capacity == 0 || header.capacity % page != 0 ||
+            (uint64_t) st.st_size < page ||
+            header.capacity > ((uint64_t) st.st_size - page) / 2 ||
+            page + 2 * header.capacity != (uint64_t) st.st_size)
+        {
+            close(fd);
+            return nullptr;
+        }
+        auto *segment = new Segment(fd, header.capacity);
+        if (!segment->map())
+        {
+            delete segment;
+            return nullptr;
+        }
+        return segment;
+    }
+    ~Segment()
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        if (control_ != nullptr)
+        {
+            munmap(control_, page);
+        }
+        if (request_data_ != nullptr)
+        {
+            munmap(request_data_, 2 * capacity_);
+        }
+        if (response_data_ != nullptr)
+        {
+            munmap(response_data_, 2 * capacity_);
+        }
+        close(fd_);
+    }
+    Segment(const Segment &) = delete;
+    Segment &operator=(const Segment &) = delete;
+
+    int fd() const
+    {
+        return fd_;
+    }
+    Ring &request()
+    {
+        return request_;
+    }
+    Ring &response()
+    {
+        return response_;
+    }
+
+private:
+    // the size can neither shrink under the mappings nor grow
+    static constexpr int kSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+    struct Header
+    {
+        uint64_t magic;
+        uint64_t capacity;
+        char padding[48];
+    };
+
+    Segment(int fd, size_t capacity) : fd_(fd), capacity_(capacity)
+    {
+    }
+
+    /**
+     * @return false, with errno set, if a mapping failed
+     */
+    bool map()
+    {
+        size_t page = sysconf(_SC_PAGESIZE);
+        check(page >= sizeof(Header) + 2 * sizeof(RingControl),
+              "page too small for the shm control block");
+        void *control = mmap(
+            nullptr, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (control == MAP_FAILED)
+        {
+            return false;
+        }
+        control_ = (char *) control;
+        header_ = (Header *) control_;
+        auto *rings = (RingControl *) (control_ + sizeof(Header));
+
+        request_data_ = map_twice(page);
+        response_data_ = map_twice(page + capacity_);
+        if (request_data_ == nullptr || response_data_ == nullptr)
+        {
+            return false;
+        }
+        request_ = Ring(&rings[0], request_data_, capacity_);
+        response_ = Ring(&rings[1], response_data_, capacity_);
+        return true;
+    }
+
+    /**
+     * @return nullptr if a mapping failed
+     */
+    char *map_twice(size_t offset)
+    {
+        void *base = mmap(nullptr,
+                          2 * capacity_,
+                          PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS,
+                          -1,
+                          0);
+        if (base == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        for (int half = 0; half < 2; ++half)
+        {
+            void *addr = (char *) base + half * capacity_;
+            if (mmap(addr,
+                     capacity_,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_FIXED,
+                     fd_,
+                     offset) != addr)
+            {
+                int saved = errno;
+                munmap(base, 2 * capacity_);
+                errno = saved;
+                return nullptr;
+            }
+        }
+        return (char *) base;
+    }
+
+    int fd_{-1};
+    size_t capacity_{0};
+    char *control_{nullptr};
+    Header *header_{nullptr};
+    char *request_data_{nullptr};
+    char *response_data_{nullptr};
+    Ring request_;
+    Ring response_;
+};
+
+/**
+ * @brief the abstract unix socket a ShmServer on @p port listens on
+ */
+inline std::string SocketName(short port)
+{
+    return "zeno-shm-" + std::to_string(port);
+}
+}  // namespace shm
+}  // namespace net
+}  // namespace zeno
+
+#endif
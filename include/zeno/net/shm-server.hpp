@@ -0,0 +1,272 @@
+#ifndef NET_SHM_SERVER_H_
+#define NET_SHM_SERVER_H_
+
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "zeno/cpu.hpp"
+#include "zeno/debug.hpp"
+#include "zeno/net/handler.hpp"
+#include "zeno/net/options.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/net/shm-ring.hpp"
+
+namespace zeno
+{
+namespace net
+{
+namespace shm
+{
+/**
+ * @brief the address of the abstract unix socket of @p port. Abstract names
+ * need no file and vanish with the socket.
+ */
+inline socklen_t SocketAddress(short port, sockaddr_un *addr)
+{
+    std::string name = SocketName(port);
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path + 1, name.data(), name.size());
+    return offsetof(sockaddr_un, sun_path) + 1 + name.size();
+}
+}  // namespace shm
+
+/**
+ * @brief serve same-host clients through shared memory
+ *
+ * A client creates a shm::Segment, connects to the abstract unix socket of
+ * the port and hands over the memfd with SCM_RIGHTS, followed by its
+ * ClientId. From then on requests and responses only go through the two
+ * rings of the segment, with the PacketHeader framing of the other
+ * transports: no syscall on the data path unless a side goes to sleep.
+ *
+ * Every client is served by its own thread, which handles all the requests
+ * available in place, copies each response into the response ring, and
+ * publishes the whole batch at once. When idle it spins, then sleeps on a
+ * futex. The unix socket only tells when the client is gone.
+ */
+template <typename Handler = EchoHandler>
+class ShmServer
+{
+public:
+    // how long an idle channel sleeps before checking for a departed client
+    static constexpr uint64_t kSleepNs = 100 * 1000 * 1000;
+
+    ShmServer(short port,
+              const ServerOptions & /* options */ = ServerOptions(),
+              Handler handler = Handler())
+        : handler_(handler)
+    {
+        listen_fd_ = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        check(listen_fd_ >= 0, "failed to create socket: %s", strerror(errno));
+        sockaddr_un addr;
+        socklen_t len = shm::SocketAddress(port, &addr);
+        check(bind(listen_fd_, (sockaddr *) &addr, len) == 0,
+              "failed to bind @%s: %s",
+              shm::SocketName(port).c_str(),
+              strerror(errno));
+        check(listen(listen_fd_, 128) == 0, "listen failed: %s", strerror(errno));
+        info("Server (shm) is listening on @%s", shm::SocketName(port).c_str());
+    }
+    ~ShmServer()
+    {
+        stop();
+        while (serving_.load(std::memory_order_acquire) != 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        close(listen_fd_);
+    }
+    ShmServer(const ShmServer &) = delete;
+    ShmServer &operator=(const ShmServer &) = delete;
+
+    /**
+     * @brief accept clients until stop(), each served on its own thread
+     * until it leaves
+     */
+    void run()
+    {
+        while (!stop_.load(std::memory_order_relaxed))
+        {
+            pollfd pfd{listen_fd_, POLLIN, 0};
+            if (::poll(&pfd, 1, kSleepNs / 1000000) <= 0)
+            {
+                continue;
+            }
+            int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                error("accept failed: %s", strerror(errno));
+                continue;
+            }
+            // detached, so that a departed client leaves nothing behind.
+            serving_.fetch_add(1, std::memory_order_relaxed);
+            std::thread([this, fd]() {
+                serve(fd);
+                serving_.fetch_sub(1, std::memory_order_release);
+            }).detach();
+        }
+    }
+
+    void stop()
+    {
+        stop_ = true;
+    }
+
+private:
+    /**
+     * @brief receive the memfd and the ClientId sent over @p fd
+     */
+    static shm::Segment *handshake(int fd, ClientId *client_id)
+    {
+        char control[CMSG_SPACE(sizeof(int))];
+        iovec iov;
+        iov.iov_base = client_id;
+        iov.iov_len = sizeof(*client_id);
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_CMSG_CLOEXEC) != sizeof(*client_id))
+        {
+            return nullptr;
+        }
+        cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS)
+        {
+            return nullptr;
+        }
+        int memfd;
+        memcpy(&memfd, CMSG_DATA(cmsg), sizeof(memfd));
+        return shm::Segment::Open(memfd);
+    }
+
+    static bool departed(int fd)
+    {
+        char c;
+        ssize_t ret = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+        return ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+    }
+
+    void serve(int fd)
+    {
+        ClientId client_id = 0;
+        std::unique_ptr<shm::Segment> segment(handshake(fd, &client_id));
+        if (!segment)
+        {
+            warn("bad shm handshake, closing the connection");
+            close(fd);
+            return;
+        }
+        info("Shm client %" PRIu64 " attached", client_id);
+        shm::Ring &requests = segment->request();
+        shm::Ring &responses = segment->response();
+        shm::SpinWaiter waiter;
+        CpuMeter meter;
+        auto deadline = std::chrono::steady_clock::now();
+        uint64_t ops = 0;
+
+        while (!stop_.load(std::memory_order_relaxed))
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                report(client_id, ops, waiter, meter);
+                ops = 0;
+                deadline = now + std::chrono::seconds(1);
+            }
+
+            size_t readable = requests.readable();
+            if (readable > requests.capacity())
+            {
+                warn("shm client %" PRIu64 " published a bad tail", client_id);
+                break;
+            }
+            if (readable == 0)
+            {
+                if (!requests.wait_readable(waiter, 0, kSleepNs) &&
+                    departed(fd))
+                {
+                    break;
+                }
+                continue;
+            }
+            bool stuck = false;
+            ssize_t n = ParseStream(
+                requests.read_ptr(),
+                readable,
+                requests.capacity(),
+                [&](char *packet, size_t length) {
+                    size_t response = handler_(packet, length);
+                    char *out;
+                    while (!stuck &&
+                           (out = responses.reserve(response)) == nullptr)
+                    {
+                        // the client is not draining its responses.
+                        if (!responses.wait_writable(waiter, response, kSleepNs) &&
+                            departed(fd))
+                        {
+                            stuck = true;
+                        }
+                    }
+                    if (stuck)
+                    {
+                        return;
+                    }
+                    memcpy(out, packet, response);
+                    responses.commit(response);
+                    meter.add(1, length);
+                    ops++;
+                });
+            if (n < 0 || stuck)
+            {
+                warn_if(n < 0, "malformed packet from shm client %" PRIu64,
+                        client_id);
+                break;
+            }
+            responses.publish();
+            requests.release(n);
+        }
+        info("Shm client %" PRIu64 " detached", client_id);
+        close(fd);
+    }
+
+    void report(ClientId client_id,
+                uint64_t ops,
+                shm::SpinWaiter &waiter,
+                CpuMeter &meter)
+    {
+        if (ops != 0)
+        {
+            info("Shm client %" PRIu64 ": %" PRIu64 " ops, %" PRIu64
+                 " waits by spinning, %" PRIu64 " by sleeping",
+                 client_id,
+                 ops,
+                 waiter.spun(),
+                 waiter.slept());
+        }
+        waiter.reset_stats();
+        meter.report("Shm per core");
+    }
+
+    int listen_fd_{-1};
+    Handler handler_;
+    std::atomic<bool> stop_{false};
+    // the clients being served, waited for on destruction
+    std::atomic<size_t> serving_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
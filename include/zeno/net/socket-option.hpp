@@ -0,0 +1,24 @@
+#ifndef NET_SOCKET_OPTION_H_
+#define NET_SOCKET_OPTION_H_
+
+#include <sys/socket.h>
+
+#include <boost/asio/detail/socket_option.hpp>
+
+namespace zeno
+{
+namespace net
+{
+namespace option
+{
+/**
+ * @brief SO_REUSEPORT, letting several sockets bind the same port while the
+ * kernel spreads incoming flows across them.
+ */
+using reuse_port =
+    boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+}  // namespace option
+}  // namespace net
+}  // namespace zeno
+
+#endif
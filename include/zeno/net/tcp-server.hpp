@@ -0,0 +1,353 @@
+#ifndef NET_TCP_SERVER_H_
+#define NET_TCP_SERVER_H_
+
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <boost/asio/deadline_timer.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <memory>
+#include <vector>
+
+#include "zeno/cpu.hpp"
+#include "zeno/debug.hpp"
+#include "zeno/define.hpp"
+#include "zeno/net/handler.hpp"
+#include "zeno/net/options.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/net/ring-buffer.hpp"
+#include "zeno/net/socket-option.hpp"
+
+namespace zeno
+{
+namespace net
+{
+using boost::asio::ip::tcp;
+
+/**
+ * @brief what the connections of a TcpServer did in the last second
+ */
+struct TcpStats
+{
+    uint64_t packets{0};
+    uint64_t bytes{0};
+    uint64_t reads{0};
+    uint64_t writevs{0};
+};
+
+/**
+ * @brief one TCP connection, carrying back-to-back PacketHeader-framed
+ * packets in both directions
+ *
+ * Bytes are read straight into a mirrored RingBuffer, and every complete
+ * packet is handled in place there. The responses stay in the ring too:
+ * they are queued as iovecs, and all those produced by one read go out with
+ * a single writev. The request bytes are consumed from the ring only once
+ * their response is written, so nothing is ever copied.
+ *
+ * Reading goes on while a write is pending, until the ring is full, so a
+ * pipelining client keeps both directions busy.
+ */
+template <typename Handler>
+class TcpConnection
+    : public std::enable_shared_from_this<TcpConnection<Handler>>
+{
+public:
+    TcpConnection(tcp::socket socket,
+                  size_t ring_size,
+                  Handler &handler,
+                  TcpStats &stats)
+        : socket_(std::move(socket)),
+          ring_(ring_size),
+          handler_(handler),
+          stats_(stats)
+    {
+        socket_.set_option(tcp::no_delay(true));
+        socket_.non_blocking(true);
+    }
+
+    void start()
+    {
+        do_read();
+    }
+
+private:
+    void do_read()
+    {
+        if (reading_ || ring_.writable() == 0 || !socket_.is_open())
+        {
+            return;
+        }
+        reading_ = true;
+        auto self = this->shared_from_this();
+        socket_.async_read_some(
+            boost::asio::buffer(ring_.write_ptr(), ring_.writable()),
+            [this, self](boost::system::error_code ec, std::size_t n) {
+                reading_ = false;
+                if (ec)
+                {
+                    dinfo_if(ec != boost::asio::error::eof,
+                             "tcp read get errno: %d",
+                             ec.value());
+                    close();
+                    return;
+                }
+                stats_.reads++;
+                ring_.commit(n);
+                if (!parse())
+                {
+                    close();
+                    return;
+                }
+                flush();
+                do_read();
+            });
+    }
+
+    /**
+     * @brief handle every complete packet after the parsed ones, queueing
+     * their responses
+     */
+    bool parse()
+    {
+        ssize_t n = ParseStream(ring_.read_ptr() + parsed_,
+                                ring_.readable() - parsed_,
+                                ring_.capacity(),
+                                [this](char *packet, size_t length) {
+                                    size_t response = handler_(packet, length);
+                                    dcheck(response <= length);
+                                    iovec iov;
+                                    iov.iov_base = packet;
+                                    iov.iov_len = response;
+                                    out_.push_back(iov);
+                                    request_lengths_.push_back(length);
+                                    stats_.packets++;
+                                    stats_.bytes += length;
+                                });
+        if (n < 0)
+        {
+            warn("malformed packet on a tcp connection, closing it");
+            return false;
+        }
+        parsed_ += n;
+        return true;
+    }
+
+    /**
+     * @brief writev the queued responses until done or the socket is full,
+     * then wait for it to drain
+     */
+    void flush()
+    {
+        if (writing_)
+        {
+            return;
+        }
+        int fd = socket_.native_handle();
+        while (head_ < out_.size())
+        {
+            int iov_nr = std::min<size_t>(out_.size() - head_, IOV_MAX);
+            ssize_t n = ::writev(fd, &out_[head_], iov_nr);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    wait_writable();
+                    return;
+                }
+                dinfo("tcp writev failed: %s", strerror(errno));
+                close();
+                return;
+            }
+            stats_.writevs++;
+            advance(n);
+        }
+        out_.clear();
+        request_lengths_.clear();
+        head_ = 0;
+        // consuming freed space in the ring: resume if the read was stalled.
+        do_read();
+    }
+
+    /**
+     * @brief account @p n written bytes: drop the fully written responses,
+     * releasing their requests from the ring, and trim a partial one
+     */
+    void advance(size_t n)
+    {
+        while (n > 0)
+        {
+            iovec &iov = out_[head_];
+            if (n < iov.iov_len)
+            {
+                iov.iov_base = (char *) iov.iov_base + n;
+                iov.iov_len -= n;
+                return;
+            }
+            n -= iov.iov_len;
+            release(head_++);
+        }
+        // zero-length responses are done as soon as we reach them.
+        while (head_ < out_.size() && out_[head_].iov_len == 0)
+        {
+            release(head_++);
+        }
+    }
+    void release(size_t i)
+    {
+        ring_.consume(request_lengths_[i]);
+        parsed_ -= request_lengths_[i];
+    }
+
+    void wait_writable()
+    {
+        writing_ = true;
+        auto self = this->shared_from_this();
+        socket_.async_wait(tcp::socket::wait_write,
+                           [this, self](boost::system::error_code ec) {
+                               writing_ = false;
+                               if (ec)
+                               {
+                                   close();
+                                   return;
+                               }
+                               flush();
+                           });
+    }
+
+    void close()
+    {
+        boost::system::error_code ignored;
+        socket_.close(ignored);
+    }
+
+    tcp::socket socket_;
+    RingBuffer ring_;
+    Handler &handler_;
+    TcpStats &stats_;
+
+    // bytes from ring_.read_ptr() already handled, whose response is queued
+    size_t parsed_{0};
+    std::vector<iovec> out_;
+    std::vector<size_t> request_lengths_;
+    size_t head_{0};
+    bool reading_{false};
+    bool writing_{false};
+};
+
+/**
+ * @brief the TCP counterpart of zeno::net::server: same header, same handler
+ *
+ * Every connection lives on the io_context of the server, so a TcpServer is
+ * single-threaded. Scale it like ShardedServer, one server per thread with
+ * ServerOptions::reuse_port, and the kernel spreads the connections.
+ */
+template <typename Handler = EchoHandler>
+class TcpServer
+{
+public:
+    static constexpr size_t kRingSize = 256 * define::KiB;
+
+    TcpServer(boost::asio::io_context &io_context,
+              short port,
+              const ServerOptions &options = ServerOptions(),
+              Handler handler = Handler())
+        : acceptor_(io_context), deadline_(io_context), handler_(handler)
+    {
+        acceptor_.open(tcp::v4());
+        acceptor_.set_option(tcp::acceptor::reuse_address(true));
+        if (options.reuse_port)
+        {
+            acceptor_.set_option(option::reuse_port(true));
+        }
+        acceptor_.bind(tcp::endpoint(tcp::v4(), port));
+        acceptor_.listen();
+
+        info("Server (tcp) is listening on 0.0.0.0:%d", port);
+        deadline_.expires_from_now(boost::posix_time::seconds(1));
+
+        check_timeout();
+        do_accept();
+    }
+
+    void check_timeout()
+    {
+        if (deadline_.expires_at() <=
+            boost::asio::deadline_timer::traits_type::now())
+        {
+            dinfo("Heartbeat one second.");
+            report();
+            deadline_.expires_from_now(boost::posix_time::seconds(1));
+        }
+        deadline_.async_wait([&](boost::system::error_code ec) {
+            if (!ec)
+            {
+                check_timeout();
+            }
+            else
+            {
+                error("timer get errno: %d", ec.value());
+            }
+        });
+    }
+
+private:
+    void do_accept()
+    {
+        acceptor_.async_accept(
+            [this](boost::system::error_code ec, tcp::socket socket) {
+                if (!ec)
+                {
+                    dinfo("Accept connection from %s:%d",
+                          socket.remote_endpoint().address().to_string().c_str(),
+                          socket.remote_endpoint().port());
+                    std::make_shared<TcpConnection<Handler>>(
+                        std::move(socket), kRingSize, handler_, stats_)
+                        ->start();
+                }
+                else
+                {
+                    error("accept get errno: %d", ec.value());
+                }
+                do_accept();
+            });
+    }
+
+    void report()
+    {
+        if (stats_.packets != 0)
+        {
+            info("TCP: %" PRIu64 " packets in %" PRIu64 " reads and %" PRIu64
+                 " writev (%.2lf per writev)",
+                 stats_.packets,
+                 stats_.reads,
+                 stats_.writevs,
+                 1.0 * stats_.packets / std::max<uint64_t>(stats_.writevs, 1));
+        }
+        meter_.add(stats_.packets, stats_.bytes);
+        meter_.report("TCP per core");
+        stats_ = TcpStats();
+    }
+
+    tcp::acceptor acceptor_;
+    boost::asio::deadline_timer deadline_;
+    Handler handler_;
+    TcpStats stats_;
+    CpuMeter meter_;
+};
+// ODR-used through make_shared before C++17.
+template <typename Handler>
+constexpr size_t TcpServer<Handler>::kRingSize;
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,257 @@
+/**
+ * @file kernel and userspace timestamps, to break the latency of a request
+ * down by stage
+ */
+#ifndef NET_TIMESTAMPS_H_
+#define NET_TIMESTAMPS_H_
+
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <atomic>
+
+#include "zeno/debug.hpp"
+#include "zeno/histogram.hpp"
+#include "zeno/smart.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief where a request spends its time in a server
+ */
+enum class Stage
+{
+    // from the software RX timestamp to the dequeue by the server
+    KernelRx,
+    // from the dequeue to the start of the handler
+    Queue,
+    Handler,
+    // from the end of the handler to the send returning or completing
+    Send,
+    // from the send call to the software TX timestamp
+    KernelTx,
+};
+constexpr size_t kStageNr = 5;
+
+inline const char *StageName(Stage stage)
+{
+    static const char *names[kStageNr] = {
+        "kernel rx", "queue", "handler", "send", "kernel tx"};
+    return names[(size_t) stage];
+}
+
+/**
+ * @brief the clock of the kernel software timestamps
+ */
+inline uint64_t RealtimeNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief have the kernel stamp every datagram received on @p fd in
+ * software, which works on loopback and any NIC. TX timestamps are then
+ * requested per message, see MsgBatch::request_tx_timestamp().
+ *
+ * @return whether the kernel accepted it
+ */
+inline bool EnableTimestamping(int fd)
+{
+    uint32_t flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+                     SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) != 0)
+    {
+        warn("failed to enable SO_TIMESTAMPING: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @return the software RX timestamp among the control messages of @p hdr,
+ * 0 if none
+ */
+inline uint64_t ParseRxTimestamp(const msghdr &hdr)
+{
+    for (cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR((msghdr *) &hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            scm_timestamping stamps;
+            memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+            return stamps.ts[0].tv_sec * 1000000000ull + stamps.ts[0].tv_nsec;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return the RX timestamp of the last datagram read from @p fd, 0 if
+ * none, for sockets read without control messages
+ */
+inline uint64_t LastRxTimestamp(int fd)
+{
+    timespec ts;
+    if (ioctl(fd, SIOCGSTAMPNS, &ts) != 0)
+    {
+        return 0;
+    }
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief call @p f(ns) for every TX software timestamp waiting in the error
+ * queue of @p fd
+ */
+template <typename F>
+inline void DrainTxTimestamps(int fd, F &&f)
+{
+    while (true)
+    {
+        union
+        {
+            char buf[CMSG_SPACE(sizeof(scm_timestamping)) +
+                     CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in))];
+            cmsghdr align;
+        } control;
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            return;
+        }
+        uint64_t ns = 0;
+        bool sent = false;
+        for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET &&
+                cmsg->cmsg_type == SCM_TIMESTAMPING)
+            {
+                scm_timestamping stamps;
+                memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+                ns = stamps.ts[0].tv_sec * 1000000000ull + stamps.ts[0].tv_nsec;
+            }
+            else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+            {
+                sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                sent = err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING &&
+                       err.ee_info == SCM_TSTAMP_SND;
+            }
+        }
+        if (sent && ns != 0)
+        {
+            f(ns);
+        }
+    }
+}
+
+/**
+ * @brief per-stage latency histograms, fed by a sample of the requests
+ *
+ * One request in sample_every is timestamped at every stage, so that the
+ * clock reads and the extra syscalls cost next to nothing and the
+ * breakdown can stay on in production. All stamps are CLOCK_REALTIME, the
+ * clock of the kernel software timestamps.
+ *
+ * sample() and record() can be called from any thread.
+ */
+class LatencyBreakdown
+{
+public:
+    /**
+     * @param sample_every 1 to stamp every request, 0 to disable
+     */
+    explicit LatencyBreakdown(uint32_t sample_every = 0)
+        : sample_every_(sample_every)
+    {
+    }
+
+    /**
+     * @brief the sampling rate in ZENO_TIMESTAMPS, 0 if unset
+     */
+    static uint32_t FromEnv(const char *name = "ZENO_TIMESTAMPS")
+    {
+        const char *spec = getenv(name);
+        uint32_t every = spec == nullptr ? 0 : strtoul(spec, nullptr, 10);
+        info_if(every != 0,
+                "Latency breakdown of one request in %u, with software "
+                "timestamps",
+                every);
+        return every;
+    }
+
+    bool enabled() const
+    {
+        return sample_every_ != 0;
+    }
+    /**
+     * @brief whether to stamp the next request
+     */
+    bool sample()
+    {
+        return enabled() &&
+               counter_.fetch_add(1, std::memory_order_relaxed) %
+                       sample_every_ ==
+                   0;
+    }
+
+    /**
+     * @brief record that @p stage lasted from @p from to @p to. Missing or
+     * reordered stamps are ignored.
+     */
+    void record(Stage stage, uint64_t from, uint64_t to)
+    {
+        if (from != 0 && to >= from)
+        {
+            histograms_[(size_t) stage].record(to - from);
+        }
+    }
+
+    /**
+     * @brief log each stage sampled since the last report
+     */
+    void report()
+    {
+        for (size_t i = 0; i < kStageNr; ++i)
+        {
+            Histogram latency;
+            histograms_[i].drain_into(latency);
+            if (latency.count() == 0)
+            {
+                continue;
+            }
+            info("Stage %-9s: %" PRIu64 " samples, p50: %s, p99: %s, max: %s",
+                 StageName((Stage) i),
+                 latency.count(),
+                 smart::nsToLatency(latency.percentile(50)).c_str(),
+                 smart::nsToLatency(latency.percentile(99)).c_str(),
+                 smart::nsToLatency(latency.max()).c_str());
+        }
+    }
+
+private:
+    uint32_t sample_every_;
+    std::atomic<uint64_t> counter_{0};
+    ConcurrentHistogram histograms_[kStageNr];
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef NET_URING_SERVER_H_
+#define NET_URING_SERVER_H_
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/net/client-registry.hpp"
+#include "zeno/net/options.hpp"
+#include "zeno/net/parser.hpp"
+#include "zeno/uring.hpp"
+
+namespace zeno
+{
+namespace net
+{
+/**
+ * @brief the echo server of zeno::net::server, built on io_uring
+ *
+ * One multishot recvmsg stays armed on the socket and lands every datagram
+ * in a buffer picked by the kernel from a provided buffer ring. The reply is
+ * a sendmsg straight from that buffer, which is recycled once the send
+ * completes. All the sends produced by one round of completions are
+ * submitted together with the next wait, so under load a single
+ * io_uring_enter serves many datagrams.
+ *
+ * run() blocks the calling thread; one UringServer should be driven by one
+ * thread only.
+ */
+class UringServer
+{
+public:
+    static constexpr unsigned kEntries = 1024;
+    static constexpr unsigned kBufferNr = 4096;
+    static constexpr unsigned kSendSlots = kBufferNr;
+    static constexpr uint16_t kBufferGroup = 0;
+    enum
+    {
+        max_length = 1024
+    };
+
+    UringServer(short port, const ServerOptions &options = ServerOptions())
+        : ring_(kEntries, IORING_SETUP_COOP_TASKRUN),
+          buffers_(ring_, kBufferGroup, kBufferNr, kHeadroom + max_length),
+          send_slots_(kSendSlots),
+          clients_(options.idle_timeout)
+    {
+        fd_ = ::socket(AF_INET, SOCK_DGRAM, 0);
+        check(fd_ >= 0, "failed to create socket: %s", strerror(errno));
+        if (options.reuse_port)
+        {
+            int one = 1;
+            check(setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) ==
+                      0,
+                  "failed to set SO_REUSEPORT: %s",
+                  strerror(errno));
+        }
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        check(bind(fd_, (sockaddr *) &addr, sizeof(addr)) == 0,
+              "failed to bind port %d: %s",
+              port,
+              strerror(errno));
+
+        info("Server (io_uring) is listening on 0.0.0.0:%d", port);
+
+        memset(&recv_msg_, 0, sizeof(recv_msg_));
+        recv_msg_.msg_namelen = sizeof(sockaddr_in);
+
+        free_slots_.reserve(kSendSlots);
+        for (unsigned i = 0; i < kSendSlots; ++i)
+        {
+            free_slots_.push_back(kSendSlots - 1 - i);
+        }
+
+        timeout_.tv_sec = 1;
+        timeout_.tv_nsec = 0;
+
+        arm_recv();
+        arm_timer();
+    }
+    ~UringServer()
+    {
+        close(fd_);
+    }
+    UringServer(const UringServer &) = delete;
+    UringServer &operator=(const UringServer &) = delete;
+
+    void run()
+    {
+        while (!stop_.load(std::memory_order_relaxed))
+        {
+            int ret = ring_.submit_and_wait(1);
+            if (ret < 0 && ret != -EINTR && ret != -EBUSY)
+            {
+                error("io_uring_enter failed: %s", strerror(-ret));
+            }
+            ring_.for_each_cqe([this](io_uring_cqe *cqe) { handle(cqe); });
+            buffers_.commit();
+        }
+    }
+
+    /**
+     * @brief ask run() to return. It notices within one heartbeat.
+     */
+    void stop()
+    {
+        stop_ = true;
+    }
+
+private:
+    enum Tag : uint64_t
+    {
+        kRecv = 1,
+        kSend = 2,
+        kTimer = 3,
+    };
+    static constexpr unsigned kTagShift = 56;
+    // what precedes the payload in a multishot recvmsg buffer.
+    static constexpr size_t kHeadroom =
+        sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in);
+
+    struct SendSlot
+    {
+        msghdr msg;
+        iovec iov;
+        unsigned bid;
+    };
+
+    io_uring_sqe *get_sqe()
+    {
+        io_uring_sqe *sqe = ring_.get_sqe();
+        if (unlikely(sqe == nullptr))
+        {
+            // the submission ring is full: flush it and try again.
+            ring_.submit_and_wait(0);
+            sqe = ring_.get_sqe();
+        }
+        return sqe;
+    }
+
+    void arm_recv()
+    {
+        io_uring_sqe *sqe = get_sqe();
+        check(sqe != nullptr, "no SQE to arm the receive");
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = fd_;
+        sqe->addr = (uint64_t) &recv_msg_;
+        sqe->len = 1;
+        sqe->msg_flags = MSG_TRUNC;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = kBufferGroup;
+        sqe->user_data = (uint64_t) kRecv << kTagShift;
+    }
+
+    void arm_timer()
+    {
+        io_uring_sqe *sqe = get_sqe();
+        check(sqe != nullptr, "no SQE to arm the timer");
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->fd = -1;
+        sqe->addr = (uint64_t) &timeout_;
+        sqe->len = 1;
+        sqe->user_data = (uint64_t) kTimer << kTagShift;
+    }
+
+    void handle(io_uring_cqe *cqe)
+    {
+        auto tag = cqe->user_data >> kTagShift;
+        if (tag == kRecv)
+        {
+            handle_recv(cqe);
+        }
+        else if (tag == kSend)
+        {
+            handle_sent(cqe);
+        }
+        else
+        {
+            dinfo("Heartbeat one second.");
+            clients_.tick();
+            clients_.report();
+            report();
+            arm_timer();
+        }
+    }
+
+    void handle_recv(io_uring_cqe *cqe)
+    {
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+        {
+            // multishot terminated, e.g. because the buffer ring ran dry.
+            arm_recv();
+        }
+        if (cqe->res < 0 || !(cqe->flags & IORING_CQE_F_BUFFER))
+        {
+            error_if(cqe->res != -ENOBUFS,
+                     "recvmsg failed: %s",
+                     strerror(-cqe->res));
+            recv_failed_++;
+            return;
+        }
+        unsigned bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char *buf = buffers_.buffer(bid);
+        auto *out = (io_uring_recvmsg_out *) buf;
+        char *name = buf + sizeof(io_uring_recvmsg_out);
+        char *payload = name + recv_msg_.msg_namelen + recv_msg_.msg_controllen;
+        size_t length = out->payloadlen;
+        if (out->flags & MSG_TRUNC)
+        {
+            length = max_length;
+        }
+        recv_datagrams_++;
+
+        if (length >= sizeof(PacketHeader))
+        {
+            clients_.on_packet(ParseClientId(payload),
+                               ParsePacketType(payload),
+                               (const sockaddr *) name,
+                               out->namelen);
+        }
+
+        if (unlikely(free_slots_.empty()))
+        {
+            send_dropped_++;
+            buffers_.recycle(bid);
+            return;
+        }
+        unsigned slot_id = free_slots_.back();
+        free_slots_.pop_back();
+        SendSlot &slot = send_slots_[slot_id];
+        memset(&slot.msg, 0, sizeof(slot.msg));
+        slot.iov.iov_base = payload;
+        slot.iov.iov_len = length;
+        slot.msg.msg_name = name;
+        slot.msg.msg_namelen = out->namelen;
+        slot.msg.msg_iov = &slot.iov;
+        slot.msg.msg_iovlen = 1;
+        slot.bid = bid;
+
+        io_uring_sqe *sqe = get_sqe();
+        check(sqe != nullptr, "no SQE for the reply");
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = fd_;
+        sqe->addr = (uint64_t) &slot.msg;
+        sqe->len = 1;
+        sqe->user_data = ((uint64_t) kSend << kTagShift) | slot_id;
+    }
+
+    void handle_sent(io_uring_cqe *cqe)
+    {
+        unsigned slot_id = cqe->user_data & ((1ull << kTagShift) - 1);
+        error_if(cqe->res < 0, "sendmsg failed: %s", strerror(-cqe->res));
+        buffers_.recycle(send_slots_[slot_id].bid);
+        free_slots_.push_back(slot_id);
+    }
+
+    void report()
+    {
+        uint64_t enter_nr = ring_.enter_nr();
+        if (recv_datagrams_ != 0)
+        {
+            info("io_uring: %" PRIu64 " datagrams in %" PRIu64
+                 " io_uring_enter (%.2lf per enter), %" PRIu64
+                 " replies dropped, %" PRIu64 " receive errors",
+                 recv_datagrams_,
+                 enter_nr - last_enter_nr_,
+                 1.0 * recv_datagrams_ / (enter_nr - last_enter_nr_),
+                 send_dropped_,
+                 recv_failed_);
+        }
+        last_enter_nr_ = enter_nr;
+        recv_datagrams_ = 0;
+        send_dropped_ = 0;
+        recv_failed_ = 0;
+    }
+
+    int fd_{-1};
+    uring::Uring ring_;
+    uring::BufferRing buffers_;
+    msghdr recv_msg_;
+    __kernel_timespec timeout_;
+
+    std::vector<SendSlot> send_slots_;
+    std::vector<unsigned> free_slots_;
+
+    ClientRegistry clients_;
+
+    std::atomic<bool> stop_{false};
+
+    uint64_t recv_datagrams_{0};
+    uint64_t recv_failed_{0};
+    uint64_t send_dropped_{0};
+    uint64_t last_enter_nr_{0};
+};
+}  // namespace net
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * @file pin worker threads to CPUs following the machine topology
+ */
+#ifndef PLACEMENT_H_
+#define PLACEMENT_H_
+
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "zeno/cpu.hpp"
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+/**
+ * @brief where a logical CPU sits in the machine
+ */
+struct CpuInfo
+{
+    int cpu;
+    int package;
+    int core;
+    int node;
+};
+
+namespace topology
+{
+inline int ReadInt(const std::string &path, int fallback)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (f == nullptr)
+    {
+        return fallback;
+    }
+    int value = fallback;
+    if (fscanf(f, "%d", &value) != 1)
+    {
+        value = fallback;
+    }
+    fclose(f);
+    return value;
+}
+
+/**
+ * @brief the NUMA node of @p cpu, from the nodeN link sysfs puts in its
+ * directory. 0 on kernels without NUMA.
+ */
+inline int NodeOf(int cpu)
+{
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr)
+    {
+        return 0;
+    }
+    int node = 0;
+    while (dirent *entry = readdir(dir))
+    {
+        if (sscanf(entry->d_name, "node%d", &node) == 1)
+        {
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+}  // namespace topology
+
+/**
+ * @brief the CPUs this process is allowed to run on, with their core,
+ * package and NUMA node
+ */
+inline std::vector<CpuInfo> ReadTopology()
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    check(sched_getaffinity(0, sizeof(set), &set) == 0,
+          "sched_getaffinity failed: %s",
+          strerror(errno));
+
+    std::vector<CpuInfo> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+    {
+        if (!CPU_ISSET(cpu, &set))
+        {
+            continue;
+        }
+        std::string dir =
+            "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+        CpuInfo c;
+        c.cpu = cpu;
+        c.package = topology::ReadInt(dir + "physical_package_id", 0);
+        c.core = topology::ReadInt(dir + "core_id", cpu);
+        c.node = topology::NodeOf(cpu);
+        cpus.push_back(c);
+    }
+    return cpus;
+}
+
+/**
+ * @brief make the memory later allocated by the calling thread come from its
+ * own NUMA node, whatever the process-wide policy (e.g. numactl --interleave)
+ */
+inline void BindMemoryLocal()
+{
+    // MPOL_LOCAL, without depending on libnuma for <numaif.h>
+    constexpr int kMpolLocal = 4;
+    if (syscall(SYS_set_mempolicy, kMpolLocal, nullptr, 0) != 0 &&
+        errno != ENOSYS)
+    {
+        warn("set_mempolicy(MPOL_LOCAL) failed: %s", strerror(errno));
+    }
+}
+
+/**
+ * @brief a policy mapping worker i to a CPU
+ *
+ * - none: workers are left to the scheduler.
+ * - compact: fill a NUMA node, core by core and hyperthread by hyperthread,
+ *   before moving to the next one. Best when workers share data.
+ * - spread: round-robin over the NUMA nodes, taking one hyperthread of every
+ *   core before any second one. Best for independent workers.
+ * - a CPU list such as "0,2,8-11": exactly those CPUs, in that order.
+ *
+ * Workers beyond the number of CPUs wrap around.
+ *
+ * pin() also binds the memory policy of the worker to its node. A worker
+ * that pins itself before allocating its buffers thus gets them NUMA-local
+ * through first touch.
+ */
+class Placement
+{
+public:
+    enum class Policy
+    {
+        None,
+        Compact,
+        Spread,
+        List,
+    };
+
+    Placement() = default;
+
+    /**
+     * @brief parse none, compact, spread or a CPU list
+     */
+    static Placement Parse(const std::string &spec)
+    {
+        Placement placement;
+        if (spec.empty() || spec == "none")
+        {
+            return placement;
+        }
+        auto cpus = ReadTopology();
+        check(!cpus.empty(), "no CPU available");
+        if (spec == "compact")
+        {
+            placement.policy_ = Policy::Compact;
+            std::sort(cpus.begin(),
+                      cpus.end(),
+                      [](const CpuInfo &a, const CpuInfo &b) {
+                          return std::make_tuple(a.node, a.package, a.core, a.cpu) <
+                                 std::make_tuple(b.node, b.package, b.core, b.cpu);
+                      });
+            placement.cpus_ = cpus;
+        }
+        else if (spec == "spread")
+        {
+            placement.policy_ = Policy::Spread;
+            placement.cpus_ = spread(cpus);
+        }
+        else
+        {
+            placement.policy_ = Policy::List;
+            placement.cpus_ = parse_list(spec, cpus);
+        }
+        return placement;
+    }
+
+    /**
+     * @brief Parse() the environment variable @p name, none if unset
+     */
+    static Placement FromEnv(const char *name = "ZENO_PLACEMENT")
+    {
+        const char *spec = getenv(name);
+        auto placement = Parse(spec == nullptr ? "" : spec);
+        info_if(placement.policy() != Policy::None,
+                "Placement %s: %s",
+                spec,
+                placement.to_string().c_str());
+        return placement;
+    }
+
+    Policy policy() const
+    {
+        return policy_;
+    }
+
+    /**
+     * @return the CPU of worker @p i, or -1 with Policy::None
+     */
+    int cpu_of(size_t i) const
+    {
+        return cpus_.empty() ? -1 : cpus_[i % cpus_.size()].cpu;
+    }
+    /**
+     * @return the NUMA node of worker @p i, or -1 with Policy::None
+     */
+    int node_of(size_t i) const
+    {
+        return cpus_.empty() ? -1 : cpus_[i % cpus_.size()].node;
+    }
+
+    /**
+     * @brief pin the calling thread as worker @p i and keep its memory on
+     * the local node. No-op with Policy::None.
+     */
+    bool pin(size_t i) const
+    {
+        if (cpus_.empty())
+        {
+            return false;
+        }
+        if (!PinThread(cpu_of(i)))
+        {
+            return false;
+        }
+        BindMemoryLocal();
+        return true;
+    }
+
+    /**
+     * @brief the CPU order, as "cpu(node) ..."
+     */
+    std::string to_string() const
+    {
+        std::string out;
+        for (const auto &c : cpus_)
+        {
+            if (!out.empty())
+            {
+                out += ' ';
+            }
+            out += std::to_string(c.cpu) + "(" + std::to_string(c.node) + ")";
+        }
+        return out;
+    }
+
+private:
+    static std::vector<CpuInfo> spread(const std::vector<CpuInfo> &cpus)
+    {
+        // per node, the first hyperthread of every core, then the second...
+        std::map<int, std::vector<std::pair<int, CpuInfo>>> nodes;
+        std::map<std::pair<int, int>, int> siblings;
+        for (const auto &c : cpus)
+        {
+            int rank = siblings[std::make_pair(c.package, c.core)]++;
+            nodes[c.node].emplace_back(rank, c);
+        }
+        for (auto &node : nodes)
+        {
+            std::stable_sort(node.second.begin(),
+                             node.second.end(),
+                             [](const std::pair<int, CpuInfo> &a,
+                                const std::pair<int, CpuInfo> &b) {
+                                 return a.first < b.first;
+                             });
+        }
+        std::vector<CpuInfo> order;
+        for (size_t round = 0; order.size() < cpus.size(); ++round)
+        {
+            for (auto &node : nodes)
+            {
+                if (round < node.second.size())
+                {
+                    order.push_back(node.second[round].second);
+                }
+            }
+        }
+        return order;
+    }
+
+    static std::vector<CpuInfo> parse_list(const std::string &spec,
+                                           const std::vector<CpuInfo> &cpus)
+    {
+        std::vector<CpuInfo> order;
+        size_t pos = 0;
+        while (pos < spec.size())
+        {
+            size_t end = spec.find(',', pos);
+            if (end == std::string::npos)
+            {
+                end = spec.size();
+            }
+            std::string item = spec.substr(pos, end - pos);
+            int first, last;
+            if (sscanf(item.c_str(), "%d-%d", &first, &last) != 2)
+            {
+                check(sscanf(item.c_str(), "%d", &first) == 1,
+                      "bad placement %s, expect none, compact, spread or a "
+                      "CPU list like 0,2,4-7",
+                      spec.c_str());
+                last = first;
+            }
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                auto it = std::find_if(cpus.begin(),
+                                       cpus.end(),
+                                       [cpu](const CpuInfo &c) {
+                                           return c.cpu == cpu;
+                                       });
+                check(it != cpus.end(), "CPU %d is not available", cpu);
+                order.push_back(*it);
+            }
+            pos = end + 1;
+        }
+        check(!order.empty(), "empty CPU list %s", spec.c_str());
+        return order;
+    }
+
+    Policy policy_{Policy::None};
+    std::vector<CpuInfo> cpus_;
+};
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,269 @@
+/**
+ * @file a hierarchical timing wheel for large numbers of coarse timers
+ */
+#ifndef TIMING_WHEEL_H_
+#define TIMING_WHEEL_H_
+
+#include <inttypes.h>
+
+#include <vector>
+
+#include "zeno/common.hpp"
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+/**
+ * @brief kLevels wheels of kSlots slots, each slot of level L spanning
+ * kSlots^L ticks
+ *
+ * schedule(), cancel() and postpone() are O(1). advance() is O(1) per tick
+ * plus the timers it fires; a timer is moved down a level at most
+ * kLevels - 1 times in its life.
+ *
+ * Timers live in a single vector of nodes linked by index and recycled
+ * through a freelist, so the memory is bounded by the peak number of live
+ * timers and no allocation happens in steady state.
+ *
+ * postpone() only records a later deadline: the timer stays in its slot,
+ * and is re-inserted when that slot comes due. This keeps the very common
+ * "client is still alive" update down to a single store.
+ *
+ * Timers further than kSlots^kLevels ticks away are parked at the horizon
+ * and re-inserted from there.
+ */
+class TimingWheel
+{
+public:
+    using TimerId = uint32_t;
+    static constexpr TimerId kInvalid = ~0u;
+    static constexpr unsigned kBits = 6;
+    static constexpr unsigned kSlots = 1u << kBits;
+    static constexpr unsigned kLevels = 4;
+    static constexpr uint64_t kHorizon = 1ull << (kBits * kLevels);
+
+    explicit TimingWheel(uint64_t now = 0) : now_(now)
+    {
+        for (auto &level : slots_)
+        {
+            for (auto &head : level)
+            {
+                head = kInvalid;
+            }
+        }
+    }
+
+    uint64_t now() const
+    {
+        return now_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+
+    /**
+     * @brief fire @p data at tick @p expire. Past ticks fire at the next one.
+     */
+    TimerId schedule(uint64_t expire, uint64_t data)
+    {
+        TimerId id;
+        if (free_ != kInvalid)
+        {
+            id = free_;
+            free_ = nodes_[id].next;
+        }
+        else
+        {
+            id = nodes_.size();
+            check(id != kInvalid, "too many timers");
+            nodes_.emplace_back();
+        }
+        Node &node = nodes_[id];
+        node.deadline = expire;
+        node.data = data;
+        node.live = true;
+        insert(id, now_ + 1);
+        size_++;
+        return id;
+    }
+
+    void cancel(TimerId id)
+    {
+        dcheck(nodes_[id].live, "cancel a dead timer %u", id);
+        unlink(id);
+        release(id);
+    }
+
+    /**
+     * @brief move the deadline of @p id later, to @p expire
+     *
+     * Earlier deadlines are ignored; cancel and schedule again instead.
+     */
+    void postpone(TimerId id, uint64_t expire)
+    {
+        Node &node = nodes_[id];
+        if (expire > node.deadline)
+        {
+            node.deadline = expire;
+        }
+    }
+
+    /**
+     * @brief jump to tick @p now at once, only while no timer is scheduled
+     */
+    void reset(uint64_t now)
+    {
+        dcheck(size_ == 0, "reset a wheel with %lu timers", size_);
+        now_ = now;
+    }
+
+    uint64_t data(TimerId id) const
+    {
+        return nodes_[id].data;
+    }
+
+    /**
+     * @brief advance to tick @p now, calling @p on_expire(id, data) for every
+     * timer whose deadline is reached
+     *
+     * A fired timer is released before @p on_expire is called, which is thus
+     * free to schedule new timers.
+     */
+    template <typename F>
+    void advance(uint64_t now, F &&on_expire)
+    {
+        while (now_ < now)
+        {
+            now_++;
+            for (unsigned level = 1; level < kLevels; ++level)
+            {
+                if ((now_ & ((1ull << (kBits * level)) - 1)) != 0)
+                {
+                    break;
+                }
+                cascade(level);
+            }
+
+            TimerId &head = slots_[0][now_ & (kSlots - 1)];
+            while (head != kInvalid)
+            {
+                TimerId id = head;
+                Node &node = nodes_[id];
+                unlink(id);
+                if (node.deadline > now_)
+                {
+                    // postponed meanwhile, or parked at the horizon.
+                    insert(id, now_ + 1);
+                    continue;
+                }
+                uint64_t data = node.data;
+                release(id);
+                on_expire(id, data);
+            }
+        }
+    }
+
+private:
+    struct Node
+    {
+        uint64_t deadline{0};
+        uint64_t data{0};
+        TimerId prev{kInvalid};
+        TimerId next{kInvalid};
+        uint8_t level{0};
+        uint8_t slot{0};
+        bool live{false};
+    };
+
+    /**
+     * @brief link @p id into the slot of its deadline, or of tick @p earliest
+     * if that comes first
+     *
+     * A cascade runs before the level 0 slot of now_ is fired, so it passes
+     * now_ and a timer due now still fires on time.
+     */
+    void insert(TimerId id, uint64_t earliest)
+    {
+        Node &node = nodes_[id];
+        uint64_t expire = node.deadline;
+        if (expire < earliest)
+        {
+            expire = earliest;
+        }
+        if (expire - now_ >= kHorizon)
+        {
+            expire = now_ + kHorizon - 1;
+        }
+        uint64_t delta = expire - now_;
+        unsigned level = 0;
+        while (level + 1 < kLevels && delta >= (1ull << (kBits * (level + 1))))
+        {
+            level++;
+        }
+        unsigned slot = (expire >> (kBits * level)) & (kSlots - 1);
+
+        TimerId &head = slots_[level][slot];
+        node.level = level;
+        node.slot = slot;
+        node.prev = kInvalid;
+        node.next = head;
+        if (head != kInvalid)
+        {
+            nodes_[head].prev = id;
+        }
+        head = id;
+    }
+
+    void unlink(TimerId id)
+    {
+        Node &node = nodes_[id];
+        if (node.prev != kInvalid)
+        {
+            nodes_[node.prev].next = node.next;
+        }
+        else
+        {
+            slots_[node.level][node.slot] = node.next;
+        }
+        if (node.next != kInvalid)
+        {
+            nodes_[node.next].prev = node.prev;
+        }
+    }
+
+    void release(TimerId id)
+    {
+        Node &node = nodes_[id];
+        node.live = false;
+        node.next = free_;
+        free_ = id;
+        size_--;
+    }
+
+    /**
+     * @brief re-insert the timers of the slot of @p level now coming due,
+     * which moves them to lower levels
+     */
+    void cascade(unsigned level)
+    {
+        TimerId &head = slots_[level][(now_ >> (kBits * level)) & (kSlots - 1)];
+        TimerId id = head;
+        head = kInvalid;
+        while (id != kInvalid)
+        {
+            TimerId next = nodes_[id].next;
+            insert(id, now_);
+            id = next;
+        }
+    }
+
+    uint64_t now_;
+    TimerId slots_[kLevels][kSlots];
+    std::vector<Node> nodes_;
+    TimerId free_{kInvalid};
+    size_t size_{0};
+};
+}  // namespace zeno
+
+#endif
@@ -0,0 +1,422 @@
+/**
+ * @file a minimal io_uring wrapper on top of the raw syscalls
+ *
+ * liburing is not required: the few pieces we need (rings setup, SQE/CQE
+ * handling and provided buffer rings) are implemented directly against
+ * <linux/io_uring.h>.
+ */
+#ifndef URING_H_
+#define URING_H_
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+
+#include "zeno/debug.hpp"
+
+namespace zeno
+{
+namespace uring
+{
+inline int setup(unsigned entries, io_uring_params *params)
+{
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+inline int enter(int fd,
+                 unsigned to_submit,
+                 unsigned min_complete,
+                 unsigned flags)
+{
+    return (int) syscall(
+        __NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+}
+inline int register_(int fd, unsigned opcode, const void *arg, unsigned nr)
+{
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr);
+}
+
+template <typename T>
+inline T load_acquire(const T *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+template <typename T>
+inline void store_release(T *p, T v)
+{
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief one io_uring instance: the submission and the completion rings
+ *
+ * Not thread safe. The intended use is one Uring per thread:
+ *
+ *   auto *sqe = ring.get_sqe();   // fill it
+ *   ring.submit_and_wait(1);
+ *   ring.for_each_cqe([](io_uring_cqe *cqe) { ... });
+ *
+ * With IORING_SETUP_SQPOLL a kernel thread polls the submission ring, so
+ * submitting takes no syscall until it idles for kSqThreadIdleMs.
+ */
+class Uring
+{
+public:
+    static constexpr unsigned kSqThreadIdleMs = 100;
+
+    explicit Uring(unsigned entries, unsigned flags = 0)
+        : sqpoll_(flags & IORING_SETUP_SQPOLL)
+    {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        params.flags = flags;
+        if (sqpoll_)
+        {
+            params.sq_thread_idle = kSqThreadIdleMs;
+        }
+        fd_ = setup(entries, &params);
+        check(fd_ >= 0,
+              "io_uring_setup failed: %s. Is io_uring supported and enabled?",
+              strerror(errno));
+        features_ = params.features;
+
+        sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size_ =
+            params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap)
+        {
+            sq_ring_size_ = cq_ring_size_ =
+                std::max(sq_ring_size_, cq_ring_size_);
+        }
+
+        sq_ring_ = map(sq_ring_size_, IORING_OFF_SQ_RING);
+        cq_ring_ = single_mmap ? sq_ring_ : map(cq_ring_size_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = (io_uring_sqe *) map(sqes_size_, IORING_OFF_SQES);
+
+        char *sq = (char *) sq_ring_;
+        sq_head_ = (unsigned *) (sq + params.sq_off.head);
+        sq_tail_ = (unsigned *) (sq + params.sq_off.tail);
+        sq_mask_ = *(unsigned *) (sq + params.sq_off.ring_mask);
+        sq_entries_ = params.sq_entries;
+        sq_flags_ = (unsigned *) (sq + params.sq_off.flags);
+        unsigned *sq_array = (unsigned *) (sq + params.sq_off.array);
+        // identity mapping, so that sqes_[i] is always array slot i.
+        for (unsigned i = 0; i < sq_entries_; ++i)
+        {
+            sq_array[i] = i;
+        }
+
+        char *cq = (char *) cq_ring_;
+        cq_head_ = (unsigned *) (cq + params.cq_off.head);
+        cq_tail_ = (unsigned *) (cq + params.cq_off.tail);
+        cq_mask_ = *(unsigned *) (cq + params.cq_off.ring_mask);
+        cqes_ = (io_uring_cqe *) (cq + params.cq_off.cqes);
+
+        sqe_tail_ = *sq_tail_;
+    }
+    ~Uring()
+    {
+        munmap(sqes_, sqes_size_);
+        if (cq_ring_ != sq_ring_)
+        {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        munmap(sq_ring_, sq_ring_size_);
+        close(fd_);
+    }
+    Uring(const Uring &) = delete;
+    Uring &operator=(const Uring &) = delete;
+
+    int fd() const
+    {
+        return fd_;
+    }
+    unsigned features() const
+    {
+        return features_;
+    }
+
+    /**
+     * @brief register @p nr buffers, as the buf_index 0 to nr - 1 of
+     * IORING_OP_READ_FIXED and IORING_OP_WRITE_FIXED. The kernel pins them
+     * once, instead of on every request.
+     *
+     * @return 0 or -errno
+     */
+    int register_buffers(const iovec *iovecs, unsigned nr)
+    {
+        return register_(fd_, IORING_REGISTER_BUFFERS, iovecs, nr) == 0
+                   ? 0
+                   : -errno;
+    }
+    /**
+     * @brief register @p nr files, as the fixed files 0 to nr - 1 of the
+     * SQEs flagged IOSQE_FIXED_FILE, which saves a file lookup per request
+     *
+     * @return 0 or -errno
+     */
+    int register_files(const int *fds, unsigned nr)
+    {
+        return register_(fd_, IORING_REGISTER_FILES, fds, nr) == 0 ? 0 : -errno;
+    }
+
+    /**
+     * @brief a zeroed SQE to fill, or nullptr if the submission ring is full
+     */
+    io_uring_sqe *get_sqe()
+    {
+        unsigned head = load_acquire(sq_head_);
+        if (sqe_tail_ - head >= sq_entries_)
+        {
+            return nullptr;
+        }
+        io_uring_sqe *sqe = &sqes_[sqe_tail_ & sq_mask_];
+        sqe_tail_++;
+        memset(sqe, 0, sizeof(*sqe));
+        return sqe;
+    }
+
+    /**
+     * @brief number of SQEs filled but not yet handed to the kernel
+     */
+    unsigned pending() const
+    {
+        return sqe_tail_ - *sq_tail_;
+    }
+
+    /**
+     * @brief publish the filled SQEs and enter the kernel once
+     *
+     * With SQPOLL the kernel is only entered to wait, or to wake the
+     * polling thread up.
+     *
+     * @param wait_nr completions to wait for before returning
+     * @return number of SQEs consumed, or -errno
+     */
+    int submit_and_wait(unsigned wait_nr = 0)
+    {
+        unsigned to_submit = pending();
+        store_release(sq_tail_, sqe_tail_);
+        unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+        if (sqpoll_)
+        {
+            // order the tail store before reading the flags, or we may miss
+            // that the polling thread went to sleep.
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (load_acquire(sq_flags_) & IORING_SQ_NEED_WAKEUP)
+            {
+                flags |= IORING_ENTER_SQ_WAKEUP;
+            }
+            else if (wait_nr == 0)
+            {
+                return to_submit;
+            }
+        }
+        else if (to_submit == 0 && wait_nr == 0)
+        {
+            return 0;
+        }
+        enter_nr_++;
+        int ret = enter(fd_, to_submit, wait_nr, flags);
+        return ret < 0 ? -errno : ret;
+    }
+
+    /**
+     * @brief call @p f on every available CQE, then mark them all seen
+     *
+     * @return number of CQEs handled
+     */
+    template <typename F>
+    unsigned for_each_cqe(F &&f)
+    {
+        unsigned head = *cq_head_;
+        unsigned tail = load_acquire(cq_tail_);
+        unsigned nr = tail - head;
+        for (; head != tail; ++head)
+        {
+            f(&cqes_[head & cq_mask_]);
+        }
+        store_release(cq_head_, tail);
+        return nr;
+    }
+
+    /**
+     * @brief how many times io_uring_enter has been called
+     */
+    uint64_t enter_nr() const
+    {
+        return enter_nr_;
+    }
+
+private:
+    void *map(size_t size, off_t offset)
+    {
+        void *ptr = mmap(nullptr,
+                         size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         fd_,
+                         offset);
+        check(ptr != MAP_FAILED, "failed to mmap io_uring: %s", strerror(errno));
+        return ptr;
+    }
+
+    int fd_{-1};
+    unsigned features_{0};
+    bool sqpoll_;
+
+    void *sq_ring_{nullptr};
+    size_t sq_ring_size_{0};
+    unsigned *sq_head_{nullptr};
+    unsigned *sq_tail_{nullptr};
+    unsigned *sq_flags_{nullptr};
+    unsigned sq_mask_{0};
+    unsigned sq_entries_{0};
+    io_uring_sqe *sqes_{nullptr};
+    size_t sqes_size_{0};
+    // local tail, published to *sq_tail_ on submit.
+    unsigned sqe_tail_{0};
+
+    void *cq_ring_{nullptr};
+    size_t cq_ring_size_{0};
+    unsigned *cq_head_{nullptr};
+    unsigned *cq_tail_{nullptr};
+    unsigned cq_mask_{0};
+    io_uring_cqe *cqes_{nullptr};
+
+    uint64_t enter_nr_{0};
+};
+
+/**
+ * @brief a provided buffer ring (IORING_REGISTER_PBUF_RING)
+ *
+ * The kernel picks a free buffer from the ring for every completion of a
+ * request marked IOSQE_BUFFER_SELECT, and reports its id in the CQE flags.
+ * The application hands it back with recycle() once it is done with it.
+ */
+class BufferRing
+{
+public:
+    BufferRing(Uring &ring,
+               uint16_t group_id,
+               unsigned buffer_nr,
+               size_t buffer_size)
+        : ring_(ring),
+          group_id_(group_id),
+          buffer_nr_(buffer_nr),
+          buffer_size_(buffer_size)
+    {
+        check(buffer_nr > 0 && (buffer_nr & (buffer_nr - 1)) == 0,
+              "buffer_nr should be a power of 2, get %u",
+              buffer_nr);
+        check(buffer_nr <= 32768, "buffer_nr should be <= 32768");
+
+        ring_size_ = buffer_nr_ * sizeof(io_uring_buf);
+        bufs_ = (io_uring_buf *) mmap(nullptr,
+                                      ring_size_,
+                                      PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANONYMOUS,
+                                      -1,
+                                      0);
+        check(bufs_ != MAP_FAILED,
+              "failed to mmap buffer ring: %s",
+              strerror(errno));
+
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.ring_addr = (uint64_t) bufs_;
+        reg.ring_entries = buffer_nr_;
+        reg.bgid = group_id_;
+        int ret = register_(ring_.fd(), IORING_REGISTER_PBUF_RING, &reg, 1);
+        check(ret == 0,
+              "IORING_REGISTER_PBUF_RING failed: %s. Linux >= 5.19 is needed.",
+              strerror(errno));
+
+        buffers_ = (char *) mmap(nullptr,
+                                 buffer_nr_ * buffer_size_,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                                 -1,
+                                 0);
+        check(buffers_ != MAP_FAILED,
+              "failed to mmap buffers: %s",
+              strerror(errno));
+
+        tail_ = (uint16_t *) ((char *) bufs_ + offsetof(io_uring_buf, resv));
+        for (unsigned i = 0; i < buffer_nr_; ++i)
+        {
+            add(i);
+        }
+        commit();
+    }
+    ~BufferRing()
+    {
+        io_uring_buf_reg reg;
+        memset(&reg, 0, sizeof(reg));
+        reg.bgid = group_id_;
+        register_(ring_.fd(), IORING_UNREGISTER_PBUF_RING, &reg, 1);
+        munmap(buffers_, buffer_nr_ * buffer_size_);
+        munmap(bufs_, ring_size_);
+    }
+    BufferRing(const BufferRing &) = delete;
+    BufferRing &operator=(const BufferRing &) = delete;
+
+    uint16_t group_id() const
+    {
+        return group_id_;
+    }
+    size_t buffer_size() const
+    {
+        return buffer_size_;
+    }
+    char *buffer(unsigned bid)
+    {
+        return buffers_ + (size_t) bid * buffer_size_;
+    }
+
+    /**
+     * @brief give buffer @p bid back to the kernel
+     *
+     * Recycled buffers become visible in batch, at the next commit().
+     */
+    void recycle(unsigned bid)
+    {
+        add(bid);
+    }
+    void commit()
+    {
+        store_release(tail_, local_tail_);
+    }
+
+private:
+    void add(unsigned bid)
+    {
+        io_uring_buf &buf = bufs_[local_tail_ & (buffer_nr_ - 1)];
+        buf.addr = (uint64_t) buffer(bid);
+        buf.len = buffer_size_;
+        buf.bid = bid;
+        local_tail_++;
+    }
+
+    Uring &ring_;
+    uint16_t group_id_;
+    unsigned buffer_nr_;
+    size_t buffer_size_;
+    io_uring_buf *bufs_{nullptr};
+    size_t ring_size_{0};
+    char *buffers_{nullptr};
+    uint16_t *tail_{nullptr};
+    uint16_t local_tail_{0};
+};
+}  // namespace uring
+}  // namespace zeno
+
+#endif
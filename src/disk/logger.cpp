@@ -1,131 +1,119 @@
 #include "zeno/disk/logger.hpp"
 
 #include <fcntl.h>
+#include <libaio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "zeno/common.hpp"
+#include "zeno/cpu.hpp"
 #include "zeno/debug.hpp"
+#include "zeno/histogram.hpp"
 #include "zeno/smart.hpp"
+#include "zeno/uring.hpp"
 namespace zeno
 {
 namespace disk
 {
-Logger::Logger(std::string filename)
+static uint64_t now_ns()
 {
-    fd_ = open(filename.c_str(), O_RDWR | O_DIRECT);
-    check(fd_ >= 0, "failed to open file %s. Is it exists?", filename.c_str());
-
-    memset(&ctx_, 0, sizeof(ctx_));
-    check(io_setup(kMaxEvent, &ctx_) == 0, "io_setup error.");
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
 
-    if (filename.find("/dev") == std::string::npos)
+static const char *EngineName(Engine engine)
+{
+    switch (engine)
     {
-        warn(
-            "It seems that %s is not a device, but a file on a filesystem. "
-            "libaio may not work well.",
-            filename.c_str());
+    case Engine::Aio:
+        return "aio";
+    case Engine::IoUring:
+        return "uring";
+    case Engine::IoUringSqpoll:
+        return "sqpoll";
     }
+    return "unknown";
 }
-Logger::~Logger()
-{
-    close(fd_);
-    io_destroy(ctx_);
-}
-void Logger::Run(int threads, int size, int seconds)
-{
-    check((unsigned long) size >= kAIOAlignment,
-          "size must be a multiple of KIOAlignment(%s), get %s",
-          smart::toSize(kAIOAlignment).c_str(),
-          smart::toSize(size).c_str());
-    check((unsigned long) size % kAIOAlignment == 0,
-          "size must be a multiple of KIOAlignment(%s), get %s",
-          smart::toSize(kAIOAlignment).c_str(),
-          smart::toSize(size).c_str());
-
-    std::atomic<uint64_t> fail_count{0};
-    std::atomic<unsigned long> fail_reason{0};
 
-    for (int i = 0; i < threads; ++i)
+/**
+ * @brief the state shared by the threads of one benchmark run
+ */
+struct Pipeline
+{
+    Pipeline(int fd, int threads, int size, size_t queue_depth)
+        : fd(fd), size(size), queue_depth(queue_depth)
     {
-        threads_.emplace_back([&, i]() {
-            char *msg;
-            check(posix_memalign((void **) &msg, kAIOAlignment, size) == 0);
-            check(msg != nullptr, "failed to alloc memory with alignment");
-
-            iocb iocb_obj;
-            io_event events[kMaxEvent];
-            timespec timeout;
-            timeout.tv_sec = 0;
-            timeout.tv_nsec = 0;
-
-            iocb *iocbs[1];
-            iocbs[0] = &iocb_obj;
-
-            while (!stop_.load(std::memory_order_relaxed))
-            {
-                long long offset = offset_.fetch_add(size);
-                io_prep_pwrite(&iocb_obj, fd_, (void *) msg, size, offset);
-                iocb_obj.data = (void *) (uint64_t) i;
-
-                int ret = io_submit(ctx_, 1, iocbs);
-                if (ret != -EAGAIN && ret < 0)
-                {
-                    check(
-                        false, "io_submit pwrite failed with errno = %d", ret);
-                }
-
-                size_t num = io_getevents(ctx_, 0, kMaxEvent, events, &timeout);
-                count_.fetch_add(num, std::memory_order_relaxed);
-
-                for (size_t i = 0; i < num; ++i)
-                {
-                    dinfo("Write succeed for %" PRIu64,
-                          (uint64_t) events[i].data);
-                    if ((long) events[0].res <= 0)
-                    {
-                        fail_count.fetch_add(1, std::memory_order_relaxed);
-                        fail_reason.store(-events[0].res,
-                                          std::memory_order_relaxed);
-                    }
-                    break;
-                }
-            }
-        });
+        for (int i = 0; i < threads; ++i)
+        {
+            latencies.emplace_back(new ConcurrentHistogram());
+        }
     }
 
-    // for (int i = 0; i < seconds; ++i)
-    // {
-    //     TimeGuard<uint64_t> tg("aio::Logger", [&]() {
-    //         return count_.load(std::memory_order_relaxed);
-    //     });
-    //     sleep(1);
-    // }
-
-    if (fail_count != 0)
+    void fail(long res)
     {
-        warn("Failed io_submit %" PRIu64 ", one of the reason is %lu",
-             fail_count.load(),
-             fail_reason.load());
+        fail_count.fetch_add(1, std::memory_order_relaxed);
+        fail_reason.store(res < 0 ? -res : EIO, std::memory_order_relaxed);
+    }
+    /**
+     * @brief add what a thread cost once it is done
+     */
+    void account(uint64_t thread_syscalls)
+    {
+        syscalls.fetch_add(thread_syscalls, std::memory_order_relaxed);
+        cpu_ns.fetch_add(ThreadCpuNs(), std::memory_order_relaxed);
     }
 
-    stop_ = true;
-    for (auto &t : threads_)
+    int fd;
+    int size;
+    size_t queue_depth;
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> fail_count{0};
+    std::atomic<unsigned long> fail_reason{0};
+    std::atomic<uint64_t> syscalls{0};
+    std::atomic<uint64_t> cpu_ns{0};
+    std::vector<std::unique_ptr<ConcurrentHistogram>> latencies;
+};
+
+/**
+ * @brief print the completed writes and their latency every second for
+ * @p seconds
+ */
+static void Report(const char *name, Pipeline &p, int seconds)
+{
+    uint64_t last = p.count.load(std::memory_order_relaxed);
+    for (int i = 0; i < seconds; ++i)
     {
-        t.join();
+        sleep(1);
+        uint64_t now = p.count.load(std::memory_order_relaxed);
+        Histogram latency;
+        for (auto &l : p.latencies)
+        {
+            l->drain_into(latency);
+        }
+        info("%s qd %lu: %s, %s/s, p50: %s, p99: %s",
+             name,
+             p.queue_depth,
+             smart::toOps(now - last).c_str(),
+             smart::toSize(1.0 * (now - last) * p.size).c_str(),
+             smart::nsToLatency(latency.percentile(50)).c_str(),
+             smart::nsToLatency(latency.percentile(99)).c_str());
+        last = now;
     }
 }
 
-InPlaceWrite::InPlaceWrite(std::string filename)
+static int OpenDirect(const std::string &filename)
 {
-    fd_ = open(filename.c_str(), O_RDWR | O_DIRECT);
-    check(fd_ >= 0, "failed to open file %s. Is it exists?", filename.c_str());
-
-    memset(&ctx_, 0, sizeof(ctx_));
-    check(io_setup(kMaxEvent, &ctx_) == 0, "io_setup error.");
-
+    int fd = open(filename.c_str(), O_RDWR | O_DIRECT);
+    check(fd >= 0, "failed to open file %s. Is it exists?", filename.c_str());
     if (filename.find("/dev") == std::string::npos)
     {
         warn(
@@ -133,87 +121,320 @@ InPlaceWrite::InPlaceWrite(std::string filename)
             "libaio may not work well.",
             filename.c_str());
     }
+    return fd;
 }
-InPlaceWrite::~InPlaceWrite()
-{
-    close(fd_);
-    io_destroy(ctx_);
-}
-void InPlaceWrite::Run(int threads, int size, int seconds)
-{
-    check((unsigned long) size >= kAIOAlignment,
-          "size must be a multiple of KIOAlignment(%s), get %s",
-          smart::toSize(kAIOAlignment).c_str(),
-          smart::toSize(size).c_str());
-    check((unsigned long) size % kAIOAlignment == 0,
-          "size must be a multiple of KIOAlignment(%s), get %s",
-          smart::toSize(kAIOAlignment).c_str(),
-          smart::toSize(size).c_str());
 
-    std::atomic<uint64_t> fail_count{0};
-    std::atomic<unsigned long> fail_reason{0};
+/**
+ * @brief the write loop of thread @p i on libaio
+ *
+ * Each round submits all the free iocbs with a single io_submit, then
+ * blocks until at least one completes and reaps all the completed ones.
+ */
+template <typename OffsetOf>
+static void AioLoop(Pipeline &p, int i, char *buffers, OffsetOf &offset_of)
+{
+    io_context_t ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    check(io_setup(p.queue_depth, &ctx) == 0, "io_setup error.");
 
-    for (int i = 0; i < threads; ++i)
+    std::vector<iocb> iocbs(p.queue_depth);
+    std::vector<uint64_t> submitted(p.queue_depth);
+    std::vector<iocb *> free_iocbs;
+    for (size_t slot = 0; slot < p.queue_depth; ++slot)
     {
-        threads_.emplace_back([&, i]() {
-            char *msg;
-            check(posix_memalign((void **) &msg, kAIOAlignment, size) == 0);
-            check(msg != nullptr, "failed to alloc memory with alignment");
-
-            iocb iocb_obj;
-            io_event events[kMaxEvent];
-            timespec timeout;
-            timeout.tv_sec = 0;
-            timeout.tv_nsec = 0;
+        free_iocbs.push_back(&iocbs[slot]);
+    }
+    std::vector<io_event> events(p.queue_depth);
+    ConcurrentHistogram &latency = *p.latencies[i];
+    size_t inflight = 0;
+    uint64_t syscalls = 0;
 
-            iocb *iocbs[1];
-            iocbs[0] = &iocb_obj;
+    while (!p.stop.load(std::memory_order_relaxed) || inflight != 0)
+    {
+        if (!p.stop.load(std::memory_order_relaxed) && !free_iocbs.empty())
+        {
+            uint64_t now = now_ns();
+            for (iocb *cb : free_iocbs)
+            {
+                size_t slot = cb - iocbs.data();
+                io_prep_pwrite(cb,
+                               p.fd,
+                               buffers + slot * p.size,
+                               p.size,
+                               offset_of(i, slot));
+                cb->data = (void *) slot;
+                submitted[slot] = now;
+            }
+            int ret = io_submit(ctx, free_iocbs.size(), free_iocbs.data());
+            syscalls++;
+            if (ret != -EAGAIN && ret < 0)
+            {
+                check(false, "io_submit pwrite failed with errno = %d", ret);
+            }
+            // a partial submission leaves the rest free for the next round.
+            size_t accepted = ret > 0 ? ret : 0;
+            free_iocbs.erase(free_iocbs.begin(), free_iocbs.begin() + accepted);
+            inflight += accepted;
+        }
+        if (inflight == 0)
+        {
+            continue;
+        }
 
-            while (!stop_.load(std::memory_order_relaxed))
+        int num = io_getevents(ctx, 1, p.queue_depth, events.data(), nullptr);
+        syscalls++;
+        if (num < 0)
+        {
+            check(num == -EINTR, "io_getevents failed with errno = %d", num);
+            continue;
+        }
+        uint64_t now = now_ns();
+        uint64_t done = 0;
+        for (int e = 0; e < num; ++e)
+        {
+            size_t slot = (size_t) events[e].data;
+            dinfo("Write succeed for slot %lu of thread %d", slot, i);
+            if ((long) events[e].res == p.size)
             {
-                io_prep_pwrite(
-                    &iocb_obj, fd_, (void *) msg, size, 0 /* offset */);
-                iocb_obj.data = (void *) (uint64_t) i;
+                done++;
+                latency.record(now - submitted[slot]);
+            }
+            else
+            {
+                p.fail((long) events[e].res);
+            }
+            free_iocbs.push_back(&iocbs[slot]);
+        }
+        inflight -= num;
+        p.count.fetch_add(done, std::memory_order_relaxed);
+    }
+    io_destroy(ctx);
+    p.account(syscalls);
+}
 
-                int ret = io_submit(ctx_, 1, iocbs);
-                if (ret != -EAGAIN && ret < 0)
-                {
-                    check(
-                        false, "io_submit pwrite failed with errno = %d", ret);
-                }
+/**
+ * @brief the write loop of thread @p i on io_uring
+ *
+ * The buffers are registered once and written with IORING_OP_WRITE_FIXED,
+ * the file is the fixed file 0. Each round fills an SQE per free slot,
+ * then submits them and waits for a completion with one io_uring_enter,
+ * which SQPOLL saves as long as nothing is to wait for.
+ */
+template <typename OffsetOf>
+static void UringLoop(Pipeline &p,
+                      int i,
+                      char *buffers,
+                      bool sqpoll,
+                      OffsetOf &offset_of)
+{
+    uring::Uring ring(p.queue_depth, sqpoll ? IORING_SETUP_SQPOLL : 0);
+    iovec iov;
+    iov.iov_base = buffers;
+    iov.iov_len = p.queue_depth * p.size;
+    int ret = ring.register_buffers(&iov, 1);
+    check(ret == 0,
+          "IORING_REGISTER_BUFFERS failed: %s. Is RLIMIT_MEMLOCK too low?",
+          strerror(-ret));
+    ret = ring.register_files(&p.fd, 1);
+    check(ret == 0, "IORING_REGISTER_FILES failed: %s", strerror(-ret));
 
-                size_t num = io_getevents(ctx_, 0, kMaxEvent, events, &timeout);
-                count_.fetch_add(num, std::memory_order_relaxed);
+    std::vector<uint64_t> submitted(p.queue_depth);
+    std::vector<size_t> free_slots;
+    for (size_t slot = p.queue_depth; slot > 0; --slot)
+    {
+        free_slots.push_back(slot - 1);
+    }
+    ConcurrentHistogram &latency = *p.latencies[i];
+    size_t inflight = 0;
 
-                for (size_t i = 0; i < num; ++i)
+    while (!p.stop.load(std::memory_order_relaxed) || inflight != 0)
+    {
+        if (!p.stop.load(std::memory_order_relaxed))
+        {
+            uint64_t now = now_ns();
+            while (!free_slots.empty())
+            {
+                io_uring_sqe *sqe = ring.get_sqe();
+                if (sqe == nullptr)
                 {
-                    dinfo("Write succeed for %" PRIu64,
-                          (uint64_t) events[i].data);
-                    if ((long) events[0].res <= 0)
-                    {
-                        fail_count.fetch_add(1, std::memory_order_relaxed);
-                        fail_reason.store(-events[0].res,
-                                          std::memory_order_relaxed);
-                    }
                     break;
                 }
+                size_t slot = free_slots.back();
+                free_slots.pop_back();
+                sqe->opcode = IORING_OP_WRITE_FIXED;
+                sqe->flags = IOSQE_FIXED_FILE;
+                sqe->fd = 0;
+                sqe->addr = (uint64_t) (buffers + slot * p.size);
+                sqe->len = p.size;
+                sqe->off = offset_of(i, slot);
+                sqe->buf_index = 0;
+                sqe->user_data = slot;
+                submitted[slot] = now;
+                inflight++;
+            }
+        }
+        ret = ring.submit_and_wait(inflight != 0 ? 1 : 0);
+        if (ret < 0)
+        {
+            check(ret == -EINTR || ret == -EAGAIN || ret == -EBUSY,
+                  "io_uring_enter failed: %s",
+                  strerror(-ret));
+        }
+
+        uint64_t now = now_ns();
+        uint64_t done = 0;
+        unsigned num = ring.for_each_cqe([&](io_uring_cqe *cqe) {
+            size_t slot = cqe->user_data;
+            if (cqe->res == p.size)
+            {
+                done++;
+                latency.record(now - submitted[slot]);
             }
+            else
+            {
+                p.fail(cqe->res);
+            }
+            free_slots.push_back(slot);
         });
+        inflight -= num;
+        p.count.fetch_add(done, std::memory_order_relaxed);
     }
+    p.account(ring.enter_nr());
+}
 
-    if (fail_count != 0)
+/**
+ * @brief @p threads threads keep @p queue_depth writes of @p size bytes each
+ * in flight on @p fd for @p seconds with @p engine, at the offsets given by
+ * offset_of(thread, slot)
+ */
+template <typename OffsetOf>
+static void RunPipeline(const char *name,
+                        int fd,
+                        Engine engine,
+                        int threads,
+                        int size,
+                        int seconds,
+                        const Placement &placement,
+                        size_t queue_depth,
+                        OffsetOf &&offset_of)
+{
+    check((unsigned long) size >= Logger::kAIOAlignment,
+          "size must be a multiple of KIOAlignment(%s), get %s",
+          smart::toSize(Logger::kAIOAlignment).c_str(),
+          smart::toSize(size).c_str());
+    check((unsigned long) size % Logger::kAIOAlignment == 0,
+          "size must be a multiple of KIOAlignment(%s), get %s",
+          smart::toSize(Logger::kAIOAlignment).c_str(),
+          smart::toSize(size).c_str());
+    check(queue_depth >= 1 && queue_depth <= Logger::kMaxEvent,
+          "queue depth must be in [1, %lu]",
+          Logger::kMaxEvent);
+
+    Pipeline p(fd, threads, size, queue_depth);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
     {
-        warn("Failed io_submit %" PRIu64 ", one of the reason is %lu",
-             fail_count.load(),
-             fail_reason.load());
+        workers.emplace_back([&, i]() {
+            placement.pin(i);
+            char *buffers;
+            check(posix_memalign((void **) &buffers,
+                                 Logger::kAIOAlignment,
+                                 queue_depth * size) == 0);
+            check(buffers != nullptr, "failed to alloc memory with alignment");
+            if (engine == Engine::Aio)
+            {
+                AioLoop(p, i, buffers, offset_of);
+            }
+            else
+            {
+                UringLoop(
+                    p, i, buffers, engine == Engine::IoUringSqpoll, offset_of);
+            }
+            free(buffers);
+        });
     }
 
-    stop_ = true;
-    for (auto &t : threads_)
+    std::string title = std::string(EngineName(engine)) + "::" + name;
+    Report(title.c_str(), p, seconds);
+
+    p.stop = true;
+    for (auto &t : workers)
     {
         t.join();
     }
+    uint64_t count = p.count.load();
+    info("%s: %.2lf syscalls and %s of CPU per write, %s per core%s",
+         title.c_str(),
+         count == 0 ? 0.0 : 1.0 * p.syscalls.load() / count,
+         smart::nsToLatency(count == 0 ? 0 : 1.0 * p.cpu_ns.load() / count)
+             .c_str(),
+         smart::toOps(p.cpu_ns.load() == 0
+                          ? 0
+                          : 1e9 * count / p.cpu_ns.load())
+             .c_str(),
+         engine == Engine::IoUringSqpoll ? " (without the SQPOLL thread)"
+                                         : "");
+    if (p.fail_count != 0)
+    {
+        warn("Failed writes %" PRIu64 ", one of the reason is %lu",
+             p.fail_count.load(),
+             p.fail_reason.load());
+    }
+}
+
+Logger::Logger(std::string filename, Engine engine)
+    : fd_(OpenDirect(filename)), engine_(engine)
+{
+}
+Logger::~Logger()
+{
+    close(fd_);
+}
+void Logger::Run(int threads,
+                 int size,
+                 int seconds,
+                 const Placement &placement,
+                 size_t queue_depth)
+{
+    RunPipeline("Logger",
+                fd_,
+                engine_,
+                threads,
+                size,
+                seconds,
+                placement,
+                queue_depth,
+                [this, size](int, size_t) {
+                    return offset_.fetch_add(size, std::memory_order_relaxed);
+                });
+}
+
+InPlaceWrite::InPlaceWrite(std::string filename, Engine engine)
+    : fd_(OpenDirect(filename)), engine_(engine)
+{
+}
+InPlaceWrite::~InPlaceWrite()
+{
+    close(fd_);
+}
+void InPlaceWrite::Run(int threads,
+                       int size,
+                       int seconds,
+                       const Placement &placement,
+                       size_t queue_depth)
+{
+    RunPipeline("InPlaceWrite",
+                fd_,
+                engine_,
+                threads,
+                size,
+                seconds,
+                placement,
+                queue_depth,
+                [size, queue_depth](int thread, size_t slot) {
+                    return (uint64_t)(thread * queue_depth + slot) * size;
+                });
 }
 
 }  // namespace disk
-}  // namespace zeno
\ No newline at end of file
+}  // namespace zeno
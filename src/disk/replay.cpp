@@ -0,0 +1,363 @@
+#include "zeno/disk/replay.hpp"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "zeno/debug.hpp"
+#include "zeno/smart.hpp"
+
+namespace zeno
+{
+namespace disk
+{
+/**
+ * @brief where a scan stands between two reads
+ */
+struct ScanState
+{
+    bool first{true};
+    // the epoch the next group names as its parent
+    uint32_t epoch{0};
+    Lsn next_lsn{0};
+};
+
+/**
+ * @brief pread @p size bytes at @p offset, or up to the end of the file
+ */
+static size_t ReadFull(int fd, char *buffer, size_t size, uint64_t offset)
+{
+    size_t done = 0;
+    while (done < size)
+    {
+        ssize_t ret = pread(fd, buffer + done, size - done, offset + done);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        check(ret >= 0, "failed to read the log: %s", strerror(errno));
+        if (ret == 0)
+        {
+            break;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+/**
+ * @brief collect into @p groups the offsets of the groups in the @p n bytes
+ * of @p buffer, as long as their headers chain up
+ *
+ * @return the bytes taken by the groups. @p end is set if the log ends in
+ * the buffer, @p torn if on a group which is cut short or corrupt.
+ */
+static size_t FindGroups(const char *buffer,
+                         size_t n,
+                         bool eof,
+                         size_t read_size,
+                         ScanState &scan,
+                         std::vector<size_t> &groups,
+                         bool &end,
+                         bool &torn)
+{
+    size_t pos = 0;
+    while (true)
+    {
+        if (pos + sizeof(GroupHeader) > n)
+        {
+            end = eof;
+            return pos;
+        }
+        const auto &header = *(const GroupHeader *) (buffer + pos);
+        if (header.magic != kGroupMagic)
+        {
+            // never written, the usual end of the log.
+            end = true;
+            return pos;
+        }
+        size_t span = GroupSpan(header.size);
+        if (header.checksum != GroupChecksum(header) || span > read_size ||
+            header.first_lsn == 0)
+        {
+            end = torn = true;
+            return pos;
+        }
+        if (!scan.first &&
+            (header.parent != scan.epoch || header.first_lsn != scan.next_lsn))
+        {
+            // left by an older writer past the end of its log.
+            end = true;
+            return pos;
+        }
+        if (pos + span > n)
+        {
+            end = torn = eof;
+            return pos;
+        }
+        groups.push_back(pos);
+        scan.first = false;
+        scan.epoch = header.epoch;
+        scan.next_lsn = header.first_lsn + header.records;
+        pos += span;
+    }
+}
+
+/**
+ * @brief call @p f on every index below @p n, from up to @p threads threads
+ */
+template <typename F>
+static void ForEachGroup(size_t threads, size_t n, F &&f)
+{
+    std::atomic<size_t> next{0};
+    auto work = [&]() {
+        size_t g;
+        while ((g = next.fetch_add(1, std::memory_order_relaxed)) < n)
+        {
+            f(g);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < std::min(threads, n); ++i)
+    {
+        workers.emplace_back(work);
+    }
+    work();
+    for (auto &t : workers)
+    {
+        t.join();
+    }
+}
+
+/**
+ * @brief call @p f on every record of @p group until it returns false
+ *
+ * @return whether all the records of the group check out
+ */
+template <typename F>
+static bool WalkGroup(const char *group, F &&f)
+{
+    const auto &header = *(const GroupHeader *) group;
+    const char *p = group + sizeof(GroupHeader);
+    const char *end = p + header.size;
+    for (uint32_t i = 0; i < header.records; ++i)
+    {
+        if (end - p < (ptrdiff_t) sizeof(RecordHeader))
+        {
+            return false;
+        }
+        const auto &record = *(const RecordHeader *) p;
+        p += sizeof(RecordHeader);
+        if (record.lsn != header.first_lsn + i ||
+            record.length > (size_t) (end - p) || !f(record, p))
+        {
+            return false;
+        }
+        p += record.length;
+    }
+    return p == end;
+}
+
+LogTail ReplayLog(int fd,
+                  const Replay &replay,
+                  const ReplayOptions &options,
+                  const LogTail &after)
+{
+    check(options.threads >= 1, "replay needs a thread");
+    check(options.read_size >= kLogBlockSize &&
+              options.read_size % kLogBlockSize == 0,
+          "read_size must be a multiple of %s, get %s",
+          smart::toSize(kLogBlockSize).c_str(),
+          smart::toSize(options.read_size).c_str());
+    char *buffers[2];
+    for (auto &buffer : buffers)
+    {
+        check(posix_memalign((void **) &buffer,
+                             kLogBlockSize,
+                             options.read_size) == 0,
+              "failed to alloc memory with alignment");
+    }
+
+    LogTail tail = after;
+    tail.end = 0;
+    ScanState scan;
+    scan.first = after.last_lsn == 0;
+    scan.epoch = after.epoch;
+    scan.next_lsn = after.last_lsn + 1;
+    uint64_t offset = 0;
+    size_t n = ReadFull(fd, buffers[0], options.read_size, offset);
+    std::vector<size_t> groups;
+    std::vector<char> ok;
+    for (int cur = 0;; cur ^= 1)
+    {
+        const char *buffer = buffers[cur];
+        bool end = false;
+        groups.clear();
+        size_t consumed = FindGroups(buffer,
+                                     n,
+                                     n < options.read_size,
+                                     options.read_size,
+                                     scan,
+                                     groups,
+                                     end,
+                                     tail.torn);
+
+        // read on while the groups are checked.
+        size_t next = 0;
+        std::thread reader;
+        if (!end)
+        {
+            reader = std::thread([&]() {
+                next = ReadFull(
+                    fd, buffers[cur ^ 1], options.read_size, offset + consumed);
+            });
+        }
+        ok.assign(groups.size(), 0);
+        ForEachGroup(options.threads, groups.size(), [&](size_t g) {
+            ok[g] = WalkGroup(buffer + groups[g],
+                              [](const RecordHeader &record, const char *data) {
+                                  return record.checksum ==
+                                         RecordChecksum(
+                                             record.lsn, data, record.length);
+                              });
+        });
+        size_t valid = std::find(ok.begin(), ok.end(), 0) - ok.begin();
+        if (replay)
+        {
+            ForEachGroup(options.threads, valid, [&](size_t g) {
+                WalkGroup(buffer + groups[g],
+                          [&](const RecordHeader &record, const char *data) {
+                              replay(record.lsn, data, record.length);
+                              return true;
+                          });
+            });
+        }
+        for (size_t g = 0; g < valid; ++g)
+        {
+            const auto &header = *(const GroupHeader *) (buffer + groups[g]);
+            if (tail.first_lsn == 0)
+            {
+                tail.first_lsn = header.first_lsn;
+            }
+            tail.last_lsn = header.first_lsn + header.records - 1;
+            tail.epoch = header.epoch;
+            tail.end = offset + groups[g] + GroupSpan(header.size);
+            tail.groups++;
+            tail.records += header.records;
+            tail.bytes += header.size;
+        }
+
+        if (reader.joinable())
+        {
+            reader.join();
+        }
+        if (valid < groups.size())
+        {
+            tail.torn = true;
+            break;
+        }
+        if (end)
+        {
+            break;
+        }
+        offset += consumed;
+        n = next;
+    }
+
+    for (auto buffer : buffers)
+    {
+        free(buffer);
+    }
+    if (tail.torn)
+    {
+        warn("the log is torn at offset %" PRIu64 ", after Lsn %" PRIu64
+             ": dropping the rest",
+             tail.end,
+             tail.last_lsn);
+    }
+    return tail;
+}
+
+LogTail ReplayLog(const std::string &filename,
+                  const Replay &replay,
+                  const ReplayOptions &options)
+{
+    int fd = open(filename.c_str(), O_RDONLY | O_DIRECT);
+    check(fd >= 0,
+          "failed to open file %s: %s",
+          filename.c_str(),
+          strerror(errno));
+    LogTail tail = ReplayLog(fd, replay, options);
+    close(fd);
+    return tail;
+}
+
+std::vector<std::pair<uint64_t, std::string>> ListSegments(
+    const std::string &prefix)
+{
+    size_t slash = prefix.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : prefix.substr(0, slash);
+    std::string base =
+        (slash == std::string::npos ? prefix : prefix.substr(slash + 1)) + ".";
+
+    std::vector<std::pair<uint64_t, std::string>> segments;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr)
+    {
+        return segments;
+    }
+    while (dirent *entry = readdir(d))
+    {
+        std::string name = entry->d_name;
+        if (name.size() <= base.size() || name.compare(0, base.size(), base))
+        {
+            continue;
+        }
+        std::string index = name.substr(base.size());
+        if (index.find_first_not_of("0123456789") != std::string::npos)
+        {
+            continue;
+        }
+        segments.emplace_back(std::stoull(index), dir + "/" + name);
+    }
+    closedir(d);
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+LogTail ReplaySegments(const std::string &prefix,
+                       const Replay &replay,
+                       const ReplayOptions &options)
+{
+    LogTail tail;
+    for (const auto &segment : ListSegments(prefix))
+    {
+        int fd = open(segment.second.c_str(), O_RDONLY | O_DIRECT);
+        check(fd >= 0,
+              "failed to open file %s: %s",
+              segment.second.c_str(),
+              strerror(errno));
+        LogTail next = ReplayLog(fd, replay, options, tail);
+        close(fd);
+        if (next.groups == tail.groups)
+        {
+            // preallocated, or left behind past the end of the log.
+            break;
+        }
+        tail = next;
+        if (tail.torn)
+        {
+            break;
+        }
+    }
+    return tail;
+}
+
+}  // namespace disk
+}  // namespace zeno
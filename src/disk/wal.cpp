@@ -0,0 +1,683 @@
+#include "zeno/disk/wal.hpp"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <system_error>
+
+#include "zeno/common.hpp"
+#include "zeno/debug.hpp"
+#include "zeno/histogram.hpp"
+#include "zeno/smart.hpp"
+
+namespace zeno
+{
+namespace disk
+{
+constexpr size_t WriteAheadLog::kBlockSize;
+constexpr size_t WriteAheadLog::kMaxEvent;
+constexpr size_t WriteAheadLog::kBenchWindow;
+
+static uint64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief make the files created or renamed in the directory of @p path
+ * durable
+ */
+static void SyncDirectory(const std::string &path)
+{
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : path.substr(0, slash);
+    int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    check(fd >= 0, "failed to open %s: %s", dir.c_str(), strerror(errno));
+    error_if(fsync(fd) != 0,
+             "failed to fsync %s: %s",
+             dir.c_str(),
+             strerror(errno));
+    close(fd);
+}
+
+WriteAheadLog::WriteAheadLog(std::string filename,
+                             const WalOptions &options,
+                             const Replay &replay)
+    : filename_(filename),
+      options_(options),
+      capacity_(GroupSpan(options.flush_size))
+{
+    check(options.flush_size > sizeof(RecordHeader),
+          "flush_size must hold a record");
+    check(capacity_ <= options.replay.read_size,
+          "a group of %s does not fit in a replay read of %s",
+          smart::toSize(capacity_).c_str(),
+          smart::toSize(options.replay.read_size).c_str());
+    check(options.queue_depth >= 1 && options.queue_depth <= kMaxEvent,
+          "queue_depth must be in [1, %lu]",
+          kMaxEvent);
+    check(options.segment_size == 0 ||
+              (options.segment_size % kBlockSize == 0 &&
+               options.segment_size >= capacity_ && options.preallocate >= 1),
+          "segment_size must be a multiple of %s holding a group of %s, with "
+          "a segment preallocated",
+          smart::toSize(kBlockSize).c_str(),
+          smart::toSize(capacity_).c_str());
+
+    recover(replay);
+    offset_ = recovered_.end;
+    next_lsn_ = recovered_.last_lsn + 1;
+    durable_lsn_ = recovered_.last_lsn;
+    parent_ = recovered_.epoch;
+    std::random_device random;
+    while (epoch_ == 0 || epoch_ == parent_)
+    {
+        epoch_ = random();
+    }
+    if (recovered_.records != 0)
+    {
+        info("recovered %" PRIu64 " records of %s, Lsn %" PRIu64
+             " to %" PRIu64 ", from %s",
+             recovered_.records,
+             smart::toSize(recovered_.bytes).c_str(),
+             recovered_.first_lsn,
+             recovered_.last_lsn,
+             filename.c_str());
+    }
+
+    memset(&ctx_, 0, sizeof(ctx_));
+    check(io_setup(kMaxEvent, &ctx_) == 0, "io_setup error.");
+
+    // one group open while queue_depth are written.
+    for (size_t i = 0; i < options.queue_depth + 1; ++i)
+    {
+        groups_.emplace_back(new Group());
+        Group *group = groups_.back().get();
+        check(posix_memalign((void **) &group->buffer, kBlockSize, capacity_) ==
+                  0,
+              "failed to alloc memory with alignment");
+        free_.push_back(group);
+    }
+    flusher_ = std::thread([this]() { flush_loop(); });
+    completer_ = std::thread([this]() { complete_loop(); });
+    if (options.segment_size != 0)
+    {
+        preallocator_ = std::thread([this]() { preallocate_loop(); });
+    }
+}
+
+WriteAheadLog::~WriteAheadLog()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    flush_cv_.notify_one();
+    flusher_.join();
+    completer_.join();
+    if (preallocator_.joinable())
+    {
+        // only now: the flusher may wait for a segment until it is done.
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            preallocate_stop_ = true;
+        }
+        preallocate_cv_.notify_one();
+        preallocator_.join();
+    }
+    for (auto &group : groups_)
+    {
+        free(group->buffer);
+    }
+    for (auto &segment : segments_)
+    {
+        close(segment.fd);
+    }
+    for (auto &segment : ready_)
+    {
+        close(segment.fd);
+    }
+    for (auto &segment : retired_)
+    {
+        close(segment.fd);
+        unlink(segment_path(segment.index).c_str());
+    }
+    io_destroy(ctx_);
+}
+
+std::string WriteAheadLog::segment_path(uint64_t index) const
+{
+    if (options_.segment_size == 0)
+    {
+        return filename_;
+    }
+    return filename_ + "." + std::to_string(index);
+}
+
+int WriteAheadLog::open_file(const std::string &path)
+{
+    int flags = O_RDWR | O_CREAT | O_DIRECT | (options_.dsync ? O_DSYNC : 0);
+    int fd = open(path.c_str(), flags, 0644);
+    check(fd >= 0, "failed to open file %s: %s", path.c_str(), strerror(errno));
+    return fd;
+}
+
+void WriteAheadLog::recover(const Replay &replay)
+{
+    if (options_.segment_size == 0)
+    {
+        int fd = open_file(filename_);
+        recovered_ = ReplayLog(fd, replay, options_.replay);
+        segments_.push_back(Segment{0, fd, recovered_.first_lsn});
+        return;
+    }
+
+    bool ended = false;
+    for (const auto &file : ListSegments(filename_))
+    {
+        int fd = open_file(file.second);
+        next_index_ = file.first + 1;
+        if (!ended)
+        {
+            LogTail tail = ReplayLog(fd, replay, options_.replay, recovered_);
+            bool found = tail.groups != recovered_.groups;
+            if (found || segments_.empty())
+            {
+                Lsn first_lsn = !found                  ? 0
+                                : recovered_.groups == 0 ? tail.first_lsn
+                                                         : recovered_.last_lsn + 1;
+                segments_.push_back(Segment{file.first, fd, first_lsn});
+                recovered_ = tail;
+                ended = !found || tail.torn;
+                continue;
+            }
+            ended = true;
+        }
+        // preallocated, or left behind past the end of the log: the scan
+        // stops at what they hold once they are written again.
+        ready_.push_back(Segment{file.first, fd, 0});
+    }
+    if (segments_.empty())
+    {
+        int fd = open_file(segment_path(0));
+        preallocate(fd);
+        segments_.push_back(Segment{0, fd, 0});
+        next_index_ = 1;
+        SyncDirectory(filename_);
+    }
+}
+
+void WriteAheadLog::preallocate(int fd)
+{
+    int ret = fallocate(fd, 0, 0, options_.segment_size);
+    if (ret != 0 && !fallocate_failed_)
+    {
+        warn("fallocate failed: %s. The writes will grow the segments",
+             strerror(errno));
+        fallocate_failed_ = true;
+    }
+}
+
+size_t WriteAheadLog::Truncate(Lsn lsn)
+{
+    lsn = std::min(lsn, durable_lsn());
+    size_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // a segment is done with once a record of the next one is: the
+        // segment written is never dropped.
+        while (segments_.size() >= 2 && segments_[1].first_lsn != 0 &&
+               segments_[1].first_lsn <= lsn)
+        {
+            retired_.push_back(segments_.front());
+            segments_.pop_front();
+            dropped++;
+        }
+        stats_.truncated += dropped;
+    }
+    if (dropped != 0)
+    {
+        preallocate_cv_.notify_one();
+    }
+    return dropped;
+}
+
+void WriteAheadLog::rotate(std::unique_lock<std::mutex> &lock)
+{
+    stats_.rotations++;
+    if (ready_.empty())
+    {
+        stats_.rotation_stalls++;
+    }
+    while (ready_.empty())
+    {
+        flush_cv_.wait(lock);
+    }
+    segments_.push_back(ready_.front());
+    ready_.pop_front();
+    offset_ = 0;
+    preallocate_cv_.notify_one();
+}
+
+void WriteAheadLog::preallocate_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!preallocate_stop_)
+    {
+        if (ready_.size() < options_.preallocate)
+        {
+            // the only one to add segments: they come in index order.
+            Segment segment{next_index_++, -1, 0};
+            bool recycle = !retired_.empty();
+            uint64_t old_index = 0;
+            if (recycle)
+            {
+                segment.fd = retired_.back().fd;
+                old_index = retired_.back().index;
+                retired_.pop_back();
+            }
+            lock.unlock();
+            std::string path = segment_path(segment.index);
+            if (recycle)
+            {
+                // its blocks are already allocated and written.
+                check(rename(segment_path(old_index).c_str(), path.c_str()) ==
+                          0,
+                      "failed to rename a segment to %s: %s",
+                      path.c_str(),
+                      strerror(errno));
+            }
+            else
+            {
+                segment.fd = open_file(path);
+                preallocate(segment.fd);
+            }
+            SyncDirectory(path);
+            lock.lock();
+            ready_.push_back(segment);
+            flush_cv_.notify_one();
+            continue;
+        }
+        if (!retired_.empty())
+        {
+            Segment segment = retired_.back();
+            retired_.pop_back();
+            lock.unlock();
+            close(segment.fd);
+            unlink(segment_path(segment.index).c_str());
+            lock.lock();
+            continue;
+        }
+        preallocate_cv_.wait(lock);
+    }
+}
+
+WriteAheadLog::Group *WriteAheadLog::open_group(
+    std::unique_lock<std::mutex> &lock)
+{
+    while (open_ == nullptr)
+    {
+        if (free_.empty())
+        {
+            free_cv_.wait(lock);
+            continue;
+        }
+        open_ = free_.back();
+        free_.pop_back();
+        open_->size = sizeof(GroupHeader);
+        open_->callbacks.clear();
+        open_->done = false;
+        open_->error = 0;
+    }
+    return open_;
+}
+
+Lsn WriteAheadLog::Append(const void *data, size_t length, Callback callback)
+{
+    size_t need = sizeof(RecordHeader) + length;
+    check(sizeof(GroupHeader) + need <= capacity_,
+          "a record of %lu bytes does not fit in a group of %lu",
+          length,
+          capacity_);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    Group *group = open_group(lock);
+    while (group->size + need > capacity_)
+    {
+        sealed_.push_back(group);
+        open_ = nullptr;
+        flush_cv_.notify_one();
+        group = open_group(lock);
+    }
+    Lsn lsn = next_lsn_++;
+    size_t pos = group->size;
+    group->size += need;
+    group->writers.fetch_add(1, std::memory_order_relaxed);
+    group->callbacks.emplace_back(lsn, std::move(callback));
+    stats_.records++;
+    stats_.bytes += need;
+    if (pos == sizeof(GroupHeader))
+    {
+        // the flusher times the group from its first record.
+        group->opened_ns = now_ns();
+        flush_cv_.notify_one();
+    }
+    if (group->size >= options_.flush_size)
+    {
+        sealed_.push_back(group);
+        open_ = nullptr;
+        flush_cv_.notify_one();
+    }
+    lock.unlock();
+
+    // the copy runs outside the lock, side by side with the other appenders.
+    RecordHeader header;
+    header.length = length;
+    header.lsn = lsn;
+    header.checksum = RecordChecksum(lsn, data, length);
+    memcpy(group->buffer + pos, &header, sizeof(header));
+    memcpy(group->buffer + pos + sizeof(header), data, length);
+    group->writers.fetch_sub(1, std::memory_order_release);
+    return lsn;
+}
+
+std::future<Lsn> WriteAheadLog::Append(const void *data, size_t length)
+{
+    auto promise = std::make_shared<std::promise<Lsn>>();
+    auto future = promise->get_future();
+    Append(data, length, [promise](Lsn lsn, int error) {
+        if (error == 0)
+        {
+            promise->set_value(lsn);
+        }
+        else
+        {
+            promise->set_exception(std::make_exception_ptr(std::system_error(
+                -error, std::generic_category(), "WAL write failed")));
+        }
+    });
+    return future;
+}
+
+void WriteAheadLog::Flush()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        flush_requested_ = true;
+    }
+    flush_cv_.notify_one();
+}
+
+void WriteAheadLog::submit(Group *group, uint64_t offset, size_t padded)
+{
+    // wait for the appenders still copying into the group.
+    while (group->writers.load(std::memory_order_acquire) != 0)
+    {
+        std::this_thread::yield();
+    }
+    memset(group->buffer + group->size, 0, padded - group->size);
+
+    GroupHeader header;
+    header.magic = kGroupMagic;
+    header.epoch = epoch_;
+    header.parent = parent_;
+    header.size = group->size - sizeof(GroupHeader);
+    header.records = group->callbacks.size();
+    header.first_lsn = group->callbacks.front().first;
+    header.checksum = GroupChecksum(header);
+    memcpy(group->buffer, &header, sizeof(header));
+    parent_ = epoch_;
+
+    io_prep_pwrite(&group->cb, group->fd, group->buffer, padded, offset);
+    group->cb.data = group;
+    iocb *iocbs[1] = {&group->cb};
+    int ret;
+    while ((ret = io_submit(ctx_, 1, iocbs)) == -EAGAIN)
+    {
+        std::this_thread::yield();
+    }
+    check(ret == 1, "io_submit pwrite failed with errno = %d", -ret);
+}
+
+void WriteAheadLog::flush_loop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        if (!sealed_.empty())
+        {
+            Group *group = sealed_.front();
+            sealed_.pop_front();
+            size_t padded =
+                (group->size + kBlockSize - 1) / kBlockSize * kBlockSize;
+            if (options_.segment_size != 0 &&
+                offset_ + padded > options_.segment_size)
+            {
+                rotate(lock);
+            }
+            Segment &segment = segments_.back();
+            if (segment.first_lsn == 0)
+            {
+                segment.first_lsn = group->callbacks.front().first;
+            }
+            group->fd = segment.fd;
+            uint64_t offset = offset_;
+            offset_ += padded;
+            // groups are written in the order they were sealed, which is the
+            // Lsn order.
+            inflight_.push_back(group);
+            stats_.groups++;
+            stats_.padding += padded - group->size;
+            lock.unlock();
+            submit(group, offset, padded);
+            lock.lock();
+            continue;
+        }
+        if (open_ != nullptr && open_->size != sizeof(GroupHeader))
+        {
+            uint64_t deadline = open_->opened_ns + options_.max_delay_us * 1000;
+            uint64_t now = now_ns();
+            if (flush_requested_ || stop_ || now >= deadline)
+            {
+                sealed_.push_back(open_);
+                open_ = nullptr;
+                flush_requested_ = false;
+                continue;
+            }
+            flush_cv_.wait_for(lock, std::chrono::nanoseconds(deadline - now));
+            continue;
+        }
+        flush_requested_ = false;
+        if (stop_)
+        {
+            return;
+        }
+        flush_cv_.wait(lock);
+    }
+}
+
+void WriteAheadLog::complete_loop()
+{
+    io_event events[kMaxEvent];
+    std::vector<Group *> finished;
+    while (true)
+    {
+        timespec timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_nsec = 10 * 1000 * 1000;
+        int num = io_getevents(ctx_, 1, kMaxEvent, events, &timeout);
+        error_if(num < 0 && num != -EINTR,
+                 "io_getevents failed with errno = %d",
+                 -num);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (int i = 0; i < num; ++i)
+        {
+            auto *group = (Group *) events[i].data;
+            long res = (long) events[i].res;
+            group->done = true;
+            if (res != (long) group->cb.u.c.nbytes)
+            {
+                group->error = res < 0 ? res : -EIO;
+                stats_.errors++;
+            }
+        }
+        // deliver in Lsn order: a group is durable once all before it are.
+        while (!inflight_.empty() && inflight_.front()->done)
+        {
+            Group *group = inflight_.front();
+            inflight_.pop_front();
+            if (group->error != 0 && !failed_)
+            {
+                error("WAL write failed: %s", strerror(-group->error));
+                failed_ = true;
+            }
+            if (failed_)
+            {
+                group->error = group->error != 0 ? group->error : -EIO;
+            }
+            else if (!group->callbacks.empty())
+            {
+                durable_lsn_.store(group->callbacks.back().first,
+                                   std::memory_order_release);
+            }
+            finished.push_back(group);
+        }
+        bool idle = stop_ && inflight_.empty() && sealed_.empty() &&
+                    (open_ == nullptr || open_->size == sizeof(GroupHeader));
+        lock.unlock();
+
+        if (!finished.empty())
+        {
+            for (Group *group : finished)
+            {
+                for (auto &callback : group->callbacks)
+                {
+                    callback.second(callback.first, group->error);
+                }
+            }
+            lock.lock();
+            free_.insert(free_.end(), finished.begin(), finished.end());
+            lock.unlock();
+            free_cv_.notify_all();
+            finished.clear();
+        }
+        if (idle)
+        {
+            return;
+        }
+    }
+}
+
+void WriteAheadLog::Run(int threads,
+                        int size,
+                        int seconds,
+                        const Placement &placement)
+{
+    size_t max_size = capacity_ - sizeof(GroupHeader) - sizeof(RecordHeader);
+    check(size > 0 && (size_t) size <= max_size,
+          "size must be in [1, %lu]",
+          max_size);
+
+    std::atomic<bool> stop{false};
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> failed{0};
+    ConcurrentHistogram latency;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.emplace_back([&, i]() {
+            placement.pin(i);
+            std::vector<char> record(size, (char) i);
+            std::atomic<size_t> pending{0};
+            while (!stop.load(std::memory_order_relaxed))
+            {
+                if (pending.load(std::memory_order_acquire) >= kBenchWindow)
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+                pending.fetch_add(1, std::memory_order_relaxed);
+                uint64_t start = now_ns();
+                Append(record.data(),
+                       record.size(),
+                       [&pending, &latency, &count, &failed, start](Lsn,
+                                                                    int error) {
+                           latency.record(now_ns() - start);
+                           count.fetch_add(1, std::memory_order_relaxed);
+                           failed.fetch_add(error != 0 ? 1 : 0,
+                                            std::memory_order_relaxed);
+                           pending.fetch_sub(1, std::memory_order_release);
+                       });
+            }
+            // the callbacks refer to pending: wait for them all.
+            Flush();
+            while (pending.load(std::memory_order_acquire) != 0)
+            {
+                std::this_thread::yield();
+            }
+        });
+    }
+
+    uint64_t last = 0;
+    WalStats last_stats;
+    for (int i = 0; i < seconds; ++i)
+    {
+        sleep(1);
+        uint64_t now = count.load(std::memory_order_relaxed);
+        WalStats stats;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats = stats_;
+        }
+        Histogram commit;
+        latency.drain_into(commit);
+        uint64_t groups = stats.groups - last_stats.groups;
+        info("wal::WriteAheadLog: %s, %s/s, %.1lf records per group, "
+             "commit p50: %s, p99: %s, max: %s",
+             smart::toOps(now - last).c_str(),
+             smart::toSize(1.0 * (now - last) * size).c_str(),
+             groups == 0 ? 0.0
+                         : 1.0 * (stats.records - last_stats.records) / groups,
+             smart::nsToLatency(commit.percentile(50)).c_str(),
+             smart::nsToLatency(commit.percentile(99)).c_str(),
+             smart::nsToLatency(commit.max()).c_str());
+        last = now;
+        last_stats = stats;
+        // a consumer checkpointing all that is durable, once a second.
+        Truncate(durable_lsn());
+    }
+
+    stop = true;
+    for (auto &t : workers)
+    {
+        t.join();
+    }
+    if (failed != 0)
+    {
+        warn("Failed WAL commits %" PRIu64, failed.load());
+    }
+    if (options_.segment_size != 0)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        info("wal::WriteAheadLog: %" PRIu64 " rotations, %" PRIu64
+             " waited for a segment, %" PRIu64 " segments truncated, %lu in "
+             "the log and %lu preallocated",
+             stats_.rotations,
+             stats_.rotation_stalls,
+             stats_.truncated,
+             segments_.size(),
+             ready_.size());
+    }
+}
+
+}  // namespace disk
+}  // namespace zeno